@@ -2,11 +2,21 @@
 #define BASIC_PITCH_HPP
 
 #include <Eigen/Dense>
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cmath>
 #include <complex>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
+#include <tuple>
+#include <type_traits>
 #include <unsupported/Eigen/CXX11/Tensor>
 #include <vector>
 
@@ -37,30 +47,376 @@ const int AUDIO_WINDOW_LENGTH = 2;
 const int MIN_NOTE_LEN = 11;
 const int MIDI_OFFSET = 21;
 const int MAX_FREQ_IDX = 87;
+const int N_FREQ_BINS_NOTES = MAX_FREQ_IDX + 1;
+const int N_FREQ_BINS_CONTOURS = N_FREQ_BINS_NOTES * CONTOURS_BINS_PER_SEMITONE;
 const int ENERGY_TOL = 11;
 constexpr float ANNOT_N_FRAMES = ANNOTATIONS_FPS * AUDIO_WINDOW_LENGTH;
 constexpr float AUDIO_N_SAMPLES = SAMPLE_RATE * AUDIO_WINDOW_LENGTH - FFT_HOP;
 
 // tempo constants
 const int MIDI_TEMPO_US = 500'000; // 120 BPM
+const int MAX_MIDI_TEMPO_US = 0xFF'FFFF; // the 24-bit SMF tempo field
 const float MIDI_TEMPO_BPM = 120.0f;
 const int TIME_SIGNATURE_NUMERATOR = 4;
 const int TIME_SIGNATURE_DENOMINATOR = 4;
 
 // midi constants
 const int DEFAULT_TPQN = 220; // ticks per quarter note
+const int MIDI_PROGRAM = 4;   // Electric Piano
 };                            // namespace constants
 
-struct InferenceResult
+// A band of MIDI pitches [min_pitch, max_pitch] within the piano range
+struct PitchRange
 {
-    Eigen::Tensor2dXf notes;
-    Eigen::Tensor2dXf onsets;
-    Eigen::Tensor2dXf contours;
+    int min_pitch = constants::MIDI_OFFSET;
+    int max_pitch = constants::MIDI_OFFSET + constants::MAX_FREQ_IDX;
+
+    bool is_full() const
+    {
+        return min_pitch == constants::MIDI_OFFSET &&
+               max_pitch == constants::MIDI_OFFSET + constants::MAX_FREQ_IDX;
+    }
+    bool is_valid() const
+    {
+        return constants::MIDI_OFFSET <= min_pitch && min_pitch <= max_pitch &&
+               max_pitch <= constants::MIDI_OFFSET + constants::MAX_FREQ_IDX;
+    }
+    int n_pitches() const { return max_pitch - min_pitch + 1; }
+
+    // note and onset bins of the band
+    int note_bin_begin() const { return min_pitch - constants::MIDI_OFFSET; }
+    int note_bin_end() const { return note_bin_begin() + n_pitches(); }
+
+    // contour bins searched for the pitch bends of notes in the band
+    int contour_bin_begin() const;
+    int contour_bin_end() const;
+    int n_contour_bins() const
+    {
+        return contour_bin_end() - contour_bin_begin();
+    }
 };
 
+// Runtime post-processing settings; the defaults reproduce basic-pitch
+struct TranscriptionConfig
+{
+    float onset_threshold = constants::ONSET_THRESHOLD;
+    float frame_threshold = constants::FRAME_THRESHOLD;
+    int min_note_len = constants::MIN_NOTE_LEN; // in frames
+    int energy_tol = constants::ENERGY_TOL;     // in frames
+
+    bool use_melodia_trick = true;
+    bool include_pitch_bends = true;
+    // bends within this many contour bins of the last one written for the
+    // note are dropped (0 drops repeats); negative writes every bend
+    int pitch_bend_tolerance = -1;
+
+    int midi_tempo_us = constants::MIDI_TEMPO_US;
+    int midi_program = constants::MIDI_PROGRAM;
+
+    // only notes in this band are tracked; pitches outside of it no longer
+    // claim energy from their neighbours, so notes on the edge pitches can
+    // differ from filtering the full-range notes
+    PitchRange pitch_range;
+
+    // whether the settings can be transcribed and written to a MIDI file;
+    // fails on NaN thresholds
+    bool is_valid() const
+    {
+        return onset_threshold >= 0.0f && onset_threshold <= 1.0f &&
+               frame_threshold >= 0.0f && frame_threshold <= 1.0f &&
+               min_note_len >= 0 && energy_tol > 0 && midi_tempo_us >= 1 &&
+               midi_tempo_us <= constants::MAX_MIDI_TEMPO_US &&
+               midi_program >= 0 && midi_program < 128 &&
+               pitch_range.is_valid();
+    }
+};
+
+// The midi_tempo_us of a tempo in beats per minute, or 0 if it does not fit
+// the SMF tempo field
+int tempo_bpm_to_us(float bpm);
+
+// The model outputs, each of shape (frames, bins). They are sigmoids in
+// [0, 1], so besides float32 they can be stored quantized to uint16_t or
+// uint8_t, x -> round(x * max), for 2x or 4x less memory on long inputs.
+//
+// The post-processing runs on the stored values directly, comparing them
+// against the thresholds scaled by the same factor. With q = 1 / (2 * max)
+// (0.0020 for uint8_t, 7.6e-6 for uint16_t) every stored value is within q
+// of the float one, so the note events only differ from the float path
+// where a decision is within q of flipping:
+// * a note or onset activation within q of frame_threshold or
+//   onset_threshold, or onsets of adjacent frames within 2q of each other
+//   (ties no longer count as peaks); this can move note boundaries or add
+//   and drop notes
+// * note amplitudes differ by at most q, so velocities by at most 1
+// * a pitch bend differs only where two Gaussian-weighted contour bins are
+//   within 2q of each other
+//
+// The outputs may only hold the columns of a pitch range: the notes and
+// onsets of its pitches and the contour bins their pitch bends search.
+template <typename T> struct BasicInferenceResult
+{
+    Eigen::Tensor<T, 2> notes;
+    Eigen::Tensor<T, 2> onsets;
+    Eigen::Tensor<T, 2> contours;
+    PitchRange pitch_range;
+};
+
+using InferenceResult = BasicInferenceResult<float>;
+using InferenceResult16 = BasicInferenceResult<uint16_t>;
+using InferenceResult8 = BasicInferenceResult<uint8_t>;
+
+// the stored value of an activation of 1.0
+template <typename T> constexpr float posteriorgram_scale()
+{
+    if constexpr (std::is_floating_point_v<T>)
+        return 1.0f;
+    else
+        return static_cast<float>(std::numeric_limits<T>::max());
+}
+
+template <typename T> inline T quantize_activation(float x)
+{
+    if constexpr (std::is_floating_point_v<T>)
+        return x;
+    else
+        return static_cast<T>(std::clamp(x, 0.0f, 1.0f) *
+                                  posteriorgram_scale<T>() +
+                              0.5f);
+}
+
 InferenceResult ort_inference(const std::vector<float> &mono_audio);
 InferenceResult ort_inference(const float *mono_audio, int length);
 
+// Inference with the outputs quantized to T as they are unwrapped, so the
+// float32 posteriorgram is never materialized; T is float, uint16_t or
+// uint8_t. Only the columns of pitch_range are kept.
+template <typename T>
+BasicInferenceResult<T> ort_inference_as(const float *mono_audio, int length,
+                                         const PitchRange &pitch_range = {});
+
+// Source of mono audio at SAMPLE_RATE, read in blocks: fills up to
+// max_samples of `out` and returns how many, 0 at the end of the audio
+using AudioReader = std::function<int(float *out, int max_samples)>;
+
+// The part of a longer input the model runs over for the frames
+// [first_frame, end_frame) of the whole input: the model windows holding
+// them, whose audio is samples [first_sample, end_sample) (end_sample may
+// be past the end of the input). Its frames are those of the whole input
+// from frame_offset to end_frame, as long as the audio read stops at
+// end_sample or the end of the input. The default is the whole input.
+struct ModelSection
+{
+    int first_window = 0;
+    int frame_offset = 0;
+    int end_frame = std::numeric_limits<int>::max();
+    int64_t first_sample = 0;
+    int64_t end_sample = std::numeric_limits<int64_t>::max();
+};
+
+ModelSection model_section(int first_frame, int end_frame);
+
+// ort_inference_as over audio read in blocks, for inputs too long to hold
+// whole: each block goes through a StreamingInference, so only a few model
+// windows of audio and outputs are in memory besides the posteriorgram.
+// `length` is the number of samples read_audio produces, which the
+// posteriorgram is allocated for up front. The frames are the same as
+// those of ort_inference over the whole audio.
+//
+// For a section, read_audio starts at its first_sample; frame t of the
+// result is then frame t + frame_offset of the whole input.
+template <typename T>
+BasicInferenceResult<T> ort_inference_as(const AudioReader &read_audio,
+                                         int64_t length,
+                                         const PitchRange &pitch_range = {},
+                                         const ModelSection &section = {});
+
+// ort_inference_as over several signals of the same length at once, e.g.
+// the channels of a file, with one reader each: every model window of all
+// of them goes through the model as one batch, so the session runs once per
+// window rather than once per window and signal. Each posteriorgram has the
+// frames ort_inference_as gives for its signal alone.
+template <typename T>
+std::vector<BasicInferenceResult<T>>
+ort_inference_channels(std::span<const AudioReader> read_audio, int64_t length,
+                       const PitchRange &pitch_range = {},
+                       const ModelSection &section = {});
+
+// quantize an existing float32 posteriorgram, e.g. one loaded from a cache
+template <typename T>
+BasicInferenceResult<T>
+quantize_posteriorgram(const InferenceResult &inference_result);
+
+// Sparse storage of one model output: only the cells at or above `floor`,
+// as runs of consecutive frames per bin (CSR with runs instead of single
+// columns). Most cells of a posteriorgram are close to zero outside of the
+// notes being played, so memory scales with the musical activity rather
+// than the duration.
+const float SPARSE_ACTIVATION_FLOOR = 0.005f;
+
+struct SparseActivations
+{
+    int n_frames = 0;
+    int n_bins = 0;
+    float floor = SPARSE_ACTIVATION_FLOOR;
+
+    // the runs of bin b are [bin_runs[b], bin_runs[b + 1])
+    std::vector<int> bin_runs = {0};
+    // first frame of each run
+    std::vector<int> run_start;
+    // the values of run r are values[run_values[r], run_values[r + 1])
+    std::vector<int> run_values = {0};
+    std::vector<float> values;
+
+    SparseActivations() = default;
+    SparseActivations(int n_frames, float floor);
+
+    // append the next bin, given its n_frames values
+    void append_bin(const float *column);
+
+    // index into `values` of the cell (t, bin), -1 if it is below the floor
+    int find(int t, int bin) const;
+
+    // the value of a cell, 0 if it is below the floor
+    float operator()(int t, int bin) const
+    {
+        int i = find(t, bin);
+        return i < 0 ? 0.0f : values[i];
+    }
+
+    // write the stored cells of frames [t_begin, t_end) of a bin to
+    // out[t - t_begin], leaving the other elements untouched
+    void copy_bin(int bin, int t_begin, int t_end, float *out) const;
+
+    int run_length(int r) const { return run_values[r + 1] - run_values[r]; }
+
+    // same as the dense tensors: (frames, bins)
+    int dimension(int i) const { return i == 0 ? n_frames : n_bins; }
+
+    std::size_t memory_bytes() const;
+};
+
+// The post-processing over sparse outputs gives the same note events as the
+// float32 path as long as the floor is at most frame_threshold and
+// onset_threshold, except:
+// * note amplitudes leave out the frames below the floor inside a note, so
+//   they are lower by less than the floor (at most one velocity step for
+//   the default floor)
+// * a pitch bend differs only if the winning contour bin of the float32
+//   path is below the floor
+struct SparseInferenceResult
+{
+    SparseActivations notes;
+    SparseActivations onsets;
+    SparseActivations contours;
+    PitchRange pitch_range;
+};
+
+// Inference with the outputs made sparse as they are unwrapped
+SparseInferenceResult
+ort_inference_sparse(const float *mono_audio, int length,
+                     float floor = SPARSE_ACTIVATION_FLOOR,
+                     const PitchRange &pitch_range = {});
+
+// Same over audio read in blocks, also for a ModelSection; the cells above
+// the floor are gathered per bin as the frames come in
+SparseInferenceResult
+ort_inference_sparse(const AudioReader &read_audio, int64_t length,
+                     float floor = SPARSE_ACTIVATION_FLOOR,
+                     const PitchRange &pitch_range = {},
+                     const ModelSection &section = {});
+
+SparseInferenceResult
+sparsify_posteriorgram(const InferenceResult &inference_result,
+                       float floor = SPARSE_ACTIVATION_FLOOR);
+
+// Inference over audio that arrives in pieces, e.g. from a live input. One
+// model session stays open and runs each window as soon as its audio is
+// in, with the same windows, overlap and trimming as ort_inference, so the
+// frames are the same as for the whole audio at once. A frame is passed on
+// once no more audio can trim it away: its N_FREQ_BINS_NOTES note and
+// onset activations and N_FREQ_BINS_CONTOURS contour activations.
+class StreamingInference
+{
+  public:
+    using FrameCallback = std::function<void(
+        const float *notes, const float *onsets, const float *contours)>;
+    using ChannelFrameCallback =
+        std::function<void(int channel, const float *notes,
+                           const float *onsets, const float *contours)>;
+
+    // Starting at model window first_window of the input, e.g. for a
+    // ModelSection, the audio pushed starts at the section's first_sample
+    // and the frames passed on are those from its frame_offset on. With
+    // n_channels, that many signals are pushed side by side and each window
+    // of all of them is run as one batch.
+    explicit StreamingInference(int first_window = 0, int n_channels = 1);
+    ~StreamingInference();
+
+    // Append mono audio at SAMPLE_RATE
+    void push_audio(const float *mono_audio, int length,
+                    const FrameCallback &on_frame);
+    // Append `length` samples at SAMPLE_RATE to each channel, those of
+    // channel c at channel_audio[c]; each frame is passed on for every
+    // channel in turn
+    void push_audio(std::span<const float *const> channel_audio, int length,
+                    const ChannelFrameCallback &on_frame);
+
+    // End of input: zero-pad and run the last windows, pass on the
+    // remaining frames and reset for a new input
+    void finish(const FrameCallback &on_frame);
+    void finish(const ChannelFrameCallback &on_frame);
+
+    // counted from the start of the input, also for a later first window
+    int64_t n_samples() const { return n_samples_; }
+    int n_frames() const { return n_frames_emitted_; }
+
+  private:
+    struct Model;
+
+    void reset();
+    void run_window();
+    void emit_frames(int n_frames, const ChannelFrameCallback &on_frame);
+
+    std::unique_ptr<Model> model_;
+    int first_window_;
+    int n_channels_;
+
+    // audio of each channel from the start of the next window; the first
+    // window of the input begins with half an overlap of zeros
+    std::vector<std::vector<float>> window_audio_;
+    int64_t n_samples_ = 0;
+
+    // frames of the windows run so far, from frame n_frames_emitted_ on;
+    // each is the notes, onsets and contours of one frame back to back, for
+    // every channel in turn
+    std::vector<float> frames_;
+    int n_frames_computed_ = 0;
+    int n_frames_emitted_ = 0;
+};
+
+// Posteriorgram cache, so post-processing can be re-run without inference.
+// The file is little-endian and versioned:
+//   [0, 8)    magic "BPPGRAM\0"
+//   [8, 12)   uint32 format version
+//   [12, 16)  uint32 number of frames
+//   [16, 20)  uint32 note/onset bins
+//   [20, 24)  uint32 contour bins
+//   [24, 64)  reserved, zero
+// followed by the notes, onsets and contours as column-major float32 arrays,
+// each starting on a 64-byte boundary so the file can be memory-mapped
+// (e.g. with numpy.memmap) and used in place.
+const uint32_t POSTERIORGRAM_CACHE_VERSION = 1;
+
+bool save_posteriorgram(const std::string &path,
+                        const InferenceResult &inference_result);
+std::optional<InferenceResult> load_posteriorgram(const std::string &path);
+
+// Write the three outputs as <prefix>.notes.npy, <prefix>.onsets.npy and
+// <prefix>.contours.npy, each of shape (frames, bins)
+bool save_posteriorgram_npy(const std::string &path_prefix,
+                            const InferenceResult &inference_result);
+
 struct NoteEvent
 {
     int start_idx;
@@ -68,20 +424,543 @@ struct NoteEvent
     int pitch;
     float amplitude;
 
-    std::optional<std::vector<int>> pitch_bends;
-
     // comparison operator for sorting
     bool operator<(const NoteEvent &other) const
     {
-        return std::tie(start_idx, end_idx, pitch, amplitude, pitch_bends) <
+        return std::tie(start_idx, end_idx, pitch, amplitude) <
                std::tie(other.start_idx, other.end_idx, other.pitch,
-                        other.amplitude, other.pitch_bends);
+                        other.amplitude);
     }
 };
 
-std::vector<uint8_t> convert_to_midi(const InferenceResult &inference_result,
-                                     const bool use_melodia_trick = true,
-                                     const bool include_pitch_bends = true);
+// Note events stored as parallel arrays. The pitch bends of all notes live in
+// one contiguous arena, and each note refers to its bends by offset and
+// length, so adding bends never allocates per note.
+struct NoteEventList
+{
+    std::vector<int> start_idx;
+    std::vector<int> end_idx;
+    std::vector<int> pitch;
+    std::vector<float> amplitude;
+
+    // offset into pitch_bend_arena, -1 for notes without pitch bends
+    std::vector<int> pitch_bend_offset;
+    std::vector<int> pitch_bend_length;
+    std::vector<int> pitch_bend_arena;
+
+    std::size_t size() const { return start_idx.size(); }
+    bool empty() const { return start_idx.empty(); }
+
+    NoteEvent operator[](std::size_t i) const
+    {
+        return {start_idx[i], end_idx[i], pitch[i], amplitude[i]};
+    }
+
+    void reserve(std::size_t n);
+    void clear();
+
+    // append a note without pitch bends
+    void push_back(const NoteEvent &note_event);
+
+    // reserve n_bends values in the arena for note i and return them to be
+    // filled in; the pointer is valid until the arena grows again
+    int *assign_pitch_bends(std::size_t i, int n_bends);
+
+    bool has_pitch_bends(std::size_t i) const
+    {
+        return pitch_bend_offset[i] >= 0;
+    }
+
+    std::span<const int> pitch_bends(std::size_t i) const
+    {
+        if (!has_pitch_bends(i))
+            return {};
+        return {pitch_bend_arena.data() + pitch_bend_offset[i],
+                static_cast<std::size_t>(pitch_bend_length[i])};
+    }
+
+    // the arena space of dropped bends is only reclaimed by clear()
+    void drop_pitch_bends(std::size_t i)
+    {
+        pitch_bend_offset[i] = -1;
+        pitch_bend_length[i] = 0;
+    }
+
+    // sort by (start, end, pitch, amplitude); pitch bends stay in place in
+    // the arena and only their offsets move with the notes
+    void sort();
+};
+
+// Static interval index over the notes of a NoteEventList, answering which
+// notes sound in a time range in O(log n) per note found, e.g. for a
+// viewport over a very long transcription. The notes are kept sorted by
+// start frame in an implicit balanced tree, each node holding the latest
+// end frame below it, so subtrees ending before the range and everything
+// starting after it are skipped.
+//
+// It can be written next to the other outputs: little-endian, an 8-byte
+// magic "BPNINDEX", a 32-bit version and note count, then per note in
+// start order its int32 start and end frames, the int32 latest end of its
+// subtree and its uint32 index in the note events as they were written.
+constexpr uint32_t NOTE_INDEX_VERSION = 1;
+
+class NoteIndex
+{
+  public:
+    NoteIndex() = default;
+    explicit NoteIndex(const NoteEventList &note_events);
+    NoteIndex(std::span<const int> start_idx, std::span<const int> end_idx);
+
+    // Indices of the notes with start_idx <= last_frame and
+    // end_idx >= first_frame, in order of start frame, appended to `out`
+    void query_frames(int first_frame, int last_frame,
+                      std::vector<uint32_t> &out) const;
+
+    // Notes sounding at some point in [t0, t1] seconds, with the note times
+    // of model_frame_to_time
+    void query(double t0, double t1, std::vector<uint32_t> &out) const;
+
+    std::size_t size() const { return note_.size(); }
+
+    bool write(std::ostream &out) const;
+    static std::optional<NoteIndex> read(std::istream &in);
+
+  private:
+    void build();
+    void query_node(std::size_t begin, std::size_t end, int first_frame,
+                    int last_frame, std::vector<uint32_t> &out) const;
+    int build_node(std::size_t begin, std::size_t end);
+
+    // in order of (start, end) frame
+    std::vector<int> start_;
+    std::vector<int> end_;
+    // latest end of the subtree [begin, end) whose middle is this element
+    std::vector<int> max_end_;
+    std::vector<uint32_t> note_;
+};
+
+// Incremental counterpart of the note tracking done by convert_to_midi, fed
+// one model frame at a time. A note is emitted once energy_tol frames of
+// sub-threshold energy confirm its end, so the lookahead is bounded to
+// energy_tol + 1 frames and the state does not grow with the input length.
+//
+// Since it never sees the whole posteriorgram, its results differ from the
+// batch path in a few ways:
+// * onsets are handled in time order instead of latest first; a new onset
+//   ends the note still open on its pitch, even if the new note is later
+//   dropped as too short
+// * onset notes do not cut off notes on neighbouring pitches
+// * the melodia trick cannot start from the global energy maximum: an
+//   unclaimed frame above frame_threshold opens a note right away, adjacent
+//   pitches in the same frame are resolved by their energy, and notes only
+//   extend forward in time
+// * pitch bends are dropped if the note overlaps any note emitted or still
+//   open when it is emitted
+class NoteTracker
+{
+  public:
+    explicit NoteTracker(const TranscriptionConfig &config = {});
+
+    // Feed the next frame: N_FREQ_BINS_NOTES note and onset activations and
+    // N_FREQ_BINS_CONTOURS contour activations, of which only those of
+    // config.pitch_range are looked at. Notes whose end is confirmed are
+    // appended to `finished`.
+    void push_frame(const float *notes, const float *onsets,
+                    const float *contours, NoteEventList &finished);
+
+    // End of input: close all open notes and reset the tracker
+    void flush(NoteEventList &finished);
+
+    int n_frames() const { return n_frames_; }
+
+    // the earliest frame a note still to be emitted can start at
+    int first_open_frame() const;
+
+  private:
+    struct OpenNote
+    {
+        bool active = false;
+        bool from_onset = false;
+        int start_idx = 0;
+        int k = 0; // consecutive sub-threshold frames
+        float amplitude_sum = 0.0f;
+        float tail_sum = 0.0f; // amplitude of the sub-threshold frames
+        std::vector<int> pitch_bends;
+    };
+
+    void open_note(int freq_idx, int t, bool from_onset);
+    void close_note(int freq_idx, int end_idx, NoteEventList &finished);
+    void process_frame(int t, NoteEventList &finished);
+
+    TranscriptionConfig config_;
+    int n_frames_ = 0;
+
+    // note bins of config_.pitch_range
+    int freq_begin_;
+    int freq_end_;
+
+    std::array<OpenNote, constants::N_FREQ_BINS_NOTES> open_notes_;
+
+    // (start, end) of emitted notes that may still overlap future notes
+    std::vector<std::pair<int, int>> recent_notes_;
+
+    // the last frame is held back until the next one confirms its onsets
+    std::vector<float> prev_onsets_;
+    std::vector<float> last_notes_;
+    std::vector<float> last_onsets_;
+    std::vector<float> last_contours_;
+};
+
+// A destination for the transcribed notes, fed one note at a time in order
+// of start frame, so that several output formats can be written in a single
+// pass over the note events
+class NoteSink
+{
+  public:
+    virtual ~NoteSink() = default;
+
+    // false if the note cannot be written
+    virtual bool add_note(const NoteEvent &note_event,
+                          std::span<const int> pitch_bends) = 0;
+    // end of the notes; false if the output cannot be completed
+    virtual bool finish() = 0;
+
+    bool add_notes(const NoteEventList &note_events);
+};
+
+// Feed each note to every sink, then finish them all
+bool write_note_events(const NoteEventList &note_events,
+                       std::span<NoteSink *const> sinks);
+
+// Notes as CSV rows, like the note events of the reference implementation:
+// start_time_s,end_time_s,pitch_midi,velocity, then the pitch bends of the
+// note (in contour bins) as further columns
+class CsvNoteWriter : public NoteSink
+{
+  public:
+    explicit CsvNoteWriter(std::ostream &out);
+    bool add_note(const NoteEvent &note_event,
+                  std::span<const int> pitch_bends) override;
+    bool finish() override;
+
+  private:
+    std::ostream &out_;
+};
+
+// Notes as a JSON array of objects with the same fields as the CSV rows,
+// the pitch bends as an array
+class JsonNoteWriter : public NoteSink
+{
+  public:
+    explicit JsonNoteWriter(std::ostream &out);
+    bool add_note(const NoteEvent &note_event,
+                  std::span<const int> pitch_bends) override;
+    bool finish() override;
+
+  private:
+    std::ostream &out_;
+    std::size_t n_notes_ = 0;
+};
+
+// Notes as little-endian binary records after an 8-byte magic and a 32-bit
+// version: one NoteRecord per note, followed by its n_pitch_bends bends as
+// int8 contour bins. The notes are read until the end of the stream.
+constexpr uint32_t NOTE_RECORD_VERSION = 1;
+
+struct NoteRecord
+{
+    uint32_t start_frame;
+    uint32_t end_frame;
+    float start_time; // in seconds
+    float end_time;
+    uint8_t pitch;
+    uint8_t velocity;
+    uint16_t n_pitch_bends;
+};
+
+class BinaryNoteWriter : public NoteSink
+{
+  public:
+    explicit BinaryNoteWriter(std::ostream &out);
+    bool add_note(const NoteEvent &note_event,
+                  std::span<const int> pitch_bends) override;
+    bool finish() override;
+
+  private:
+    std::ostream &out_;
+    std::vector<int8_t> bends_;
+};
+
+// Builds the NoteIndex of the notes as they are added and writes it on
+// finish(); the note indices it holds are the order of the notes added
+class NoteIndexWriter : public NoteSink
+{
+  public:
+    explicit NoteIndexWriter(std::ostream &out);
+    bool add_note(const NoteEvent &note_event,
+                  std::span<const int> pitch_bends) override;
+    bool finish() override;
+
+  private:
+    std::ostream &out_;
+    std::vector<int> start_idx_;
+    std::vector<int> end_idx_;
+};
+
+// Writes the Standard MIDI File of note_events_to_midi to a file descriptor
+// as notes are added, for transcriptions too long to hold all of their MIDI
+// events. Notes must be added in order of start frame: only the events that
+// can still interleave with later notes (note offs and pitch bends past the
+// latest note start) are held back, and the encoded bytes go out through a
+// fixed-size buffer. The track length is only known at the end, so finish()
+// writes it back into the header; on an fd that cannot seek, such as a
+// pipe, the whole file is held in the buffer until then instead.
+//
+// With several tracks, e.g. one per audio channel, each finish() ends a
+// track and the notes added after it go to the next one, on the next MIDI
+// channel; the file is complete after the last. There is a track for each
+// MIDI channel but the percussion one at most.
+constexpr int MAX_MIDI_TRACKS = 15;
+
+class MidiStreamWriter : public NoteSink
+{
+  public:
+    explicit MidiStreamWriter(int fd, const TranscriptionConfig &config = {},
+                              int n_tracks = 1);
+
+    // false if the note starts before the previous one of its track or
+    // writing failed
+    bool add_note(const NoteEvent &note_event,
+                  std::span<const int> pitch_bends = {}) override;
+
+    // Write the held-back events, end the track and write its length
+    bool finish() override;
+
+    std::size_t bytes_written() const { return bytes_written_; }
+    // the most events held back at once
+    std::size_t max_pending_events() const { return max_pending_events_; }
+
+  private:
+    // encode the held-back events before `tick`
+    bool write_pending(uint64_t tick);
+    // make room in the buffer, writing it out if the fd can seek
+    bool flush_buffer();
+    bool write_buffer();
+
+    int fd_;
+    TranscriptionConfig config_;
+    int64_t start_offset_; // of the file in fd_, -1 if it cannot seek
+    bool ok_ = true;
+    int last_start_idx_ = 0;
+
+    int n_tracks_;
+    int track_ = 0;
+    // of the length of the current track, from the start of the file
+    std::size_t track_length_offset_;
+
+    // min-heap of (event, order added), so that events of equal tick and
+    // type are written in the order they were added, as in a full sort
+    std::vector<std::pair<uint64_t, uint64_t>> pending_;
+    uint64_t n_events_added_ = 0;
+    std::size_t max_pending_events_ = 0;
+    std::vector<uint64_t> note_events_;
+
+    uint32_t last_tick_ = 0;
+    uint8_t running_status_;
+    std::vector<uint8_t> buffer_;
+    std::size_t buffer_size_ = 0;
+    std::size_t bytes_written_ = 0;
+};
+
+// A MIDI channel message of the live output, with its time in the audio
+struct LiveMidiMessage
+{
+    double time;   // in seconds from the start of the audio
+    uint32_t tick; // as written to the MIDI file
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+    // from the arrival of the audio at `time` to the message being passed on
+    double latency_ms;
+};
+
+// Transcription of audio that arrives in pieces, passing on the note on,
+// pitch bend and note off messages of each note as soon as the NoteTracker
+// confirms its end, with the same events as note_events_to_midi would
+// write for it. The latency of a note is its length plus the model window
+// that must be in before its last frames, plus energy_tol + 1 frames of
+// lookahead. Each batch of notes is passed on in time order, but a short
+// note can be finished before a longer one that started earlier, so the
+// times only increase within a batch.
+class LiveTranscriber
+{
+  public:
+    // false to stop the transcription, e.g. if the message cannot be written
+    using MessageCallback = std::function<bool(const LiveMidiMessage &)>;
+
+    explicit LiveTranscriber(MessageCallback on_message,
+                             const TranscriptionConfig &config = {});
+
+    // Append mono audio at SAMPLE_RATE; false once the callback failed
+    bool push_audio(const float *mono_audio, int length);
+
+    // End of input: pass on the remaining notes and reset for a new input
+    bool finish();
+
+    std::size_t n_messages() const { return n_messages_; }
+    double mean_latency_ms() const
+    {
+        return n_messages_ > 0 ? latency_sum_ms_ / n_messages_ : 0.0;
+    }
+    double max_latency_ms() const { return max_latency_ms_; }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    void push_frame(const float *notes, const float *onsets,
+                    const float *contours);
+    bool emit_finished();
+    Clock::time_point arrival_time(double time) const;
+
+    MessageCallback on_message_;
+    TranscriptionConfig config_;
+    StreamingInference inference_;
+    NoteTracker tracker_;
+    bool ok_ = true;
+
+    NoteEventList finished_;
+    std::vector<uint64_t> midi_events_;
+    std::vector<uint64_t> scratch_;
+
+    // (samples received, arrival time) of each piece of audio a note still
+    // to be finished can start in
+    std::vector<std::pair<int64_t, Clock::time_point>> arrivals_;
+
+    std::size_t n_messages_ = 0;
+    double latency_sum_ms_ = 0.0;
+    double max_latency_ms_ = 0.0;
+};
+
+// A message callback writing each message to `fd`, e.g. a pipe or FIFO, as
+// a line of text: time in seconds, tick, the three bytes in hex and the
+// latency in milliseconds
+LiveTranscriber::MessageCallback live_message_writer(int fd);
+
+// Transcription of audio that arrives in pieces, e.g. from a pipe, into
+// NoteSinks. Frames go through a StreamingInference and a NoteTracker as
+// they come in, so neither the audio nor the posteriorgram is held. The
+// notes the tracker finishes are passed on in order of start frame once no
+// note still open can start before them; only those waiting for an earlier
+// note are held. The notes are those of the NoteTracker, not of the batch
+// path.
+class StreamingTranscriber
+{
+  public:
+    StreamingTranscriber(std::span<NoteSink *const> sinks,
+                         const TranscriptionConfig &config = {});
+
+    // Append mono audio at SAMPLE_RATE; false once a sink failed
+    bool push_audio(const float *mono_audio, int length);
+
+    // End of input: pass on the remaining notes and finish the sinks
+    bool finish();
+
+    // frames and notes passed on so far
+    int n_frames() const { return n_frames_; }
+    std::size_t n_notes() const { return n_notes_; }
+
+  private:
+    void push_frame(const float *notes, const float *onsets,
+                    const float *contours);
+    // pass on the finished notes starting before end_frame
+    bool emit_notes(int end_frame);
+
+    std::vector<NoteSink *> sinks_;
+    StreamingInference inference_;
+    NoteTracker tracker_;
+    bool ok_ = true;
+
+    // notes as the tracker finishes them, and those waiting to be passed
+    // on, sorted
+    NoteEventList finished_;
+    NoteEventList pending_;
+    NoteEventList scratch_;
+    int n_frames_ = 0;
+    std::size_t n_notes_ = 0;
+};
+
+// The post-processing stages run by convert_to_midi, exposed to be driven
+// (and timed) separately:
+// (all of them accept float32, quantized and sparse posteriorgrams)
+// * note tracking on onsets and frames, plus the melodia trick if enabled
+template <typename T>
+NoteEventList
+output_to_notes_polyphonic(const BasicInferenceResult<T> &inference_result,
+                           const TranscriptionConfig &config = {});
+
+// * pitch bends from the contours, dropped again for overlapping notes;
+//   contour_range is the pitch range whose contour bins are stored (the
+//   pitch_range of the inference result), and the notes must lie within it
+template <typename T>
+void add_pitch_bends(const Eigen::Tensor<T, 2> &contours,
+                     NoteEventList &note_events,
+                     const PitchRange &contour_range);
+
+NoteEventList
+output_to_notes_polyphonic(const SparseInferenceResult &inference_result,
+                           const TranscriptionConfig &config = {});
+void add_pitch_bends(const SparseActivations &contours,
+                     NoteEventList &note_events,
+                     const PitchRange &contour_range);
+
+// * the last step of add_pitch_bends: sort the notes by start and drop the
+//   pitch bends of every note that overlaps another one, in one sweep
+void drop_overlapping_pitch_bends(NoteEventList &note_events);
+
+// * Standard MIDI File bytes for the note events
+std::vector<uint8_t>
+note_events_to_midi(const NoteEventList &note_events,
+                    const TranscriptionConfig &config = {});
+
+// The same file written into a caller-supplied buffer of at least
+// midi_size_bound(note_events) bytes; returns the bytes written
+std::size_t midi_size_bound(const NoteEventList &note_events);
+std::size_t write_midi(const NoteEventList &note_events,
+                       const TranscriptionConfig &config, uint8_t *out);
+
+// start time in seconds of a model frame, as written to the MIDI file
+double model_frame_to_time(int frame);
+
+// the last frame starting at or before `time` (-1 before time 0), and the
+// first one starting at or after it
+int last_frame_at_or_before(double time);
+int first_frame_at_or_after(double time);
+
+template <typename T>
+std::vector<uint8_t>
+convert_to_midi(const BasicInferenceResult<T> &inference_result,
+                const TranscriptionConfig &config = {});
+std::vector<uint8_t>
+convert_to_midi(const SparseInferenceResult &inference_result,
+                const TranscriptionConfig &config = {});
+
+// convert_to_midi with the file streamed to `fd` by a MidiStreamWriter
+// instead of returned; false if writing failed
+template <typename T>
+bool convert_to_midi(const BasicInferenceResult<T> &inference_result, int fd,
+                     const TranscriptionConfig &config = {});
+bool convert_to_midi(const SparseInferenceResult &inference_result, int fd,
+                     const TranscriptionConfig &config = {});
+
+// The post-processing of convert_to_midi with the notes written to each of
+// the sinks in one pass; false if one of them failed
+template <typename T>
+bool convert_to_notes(const BasicInferenceResult<T> &inference_result,
+                      std::span<NoteSink *const> sinks,
+                      const TranscriptionConfig &config = {});
+bool convert_to_notes(const SparseInferenceResult &inference_result,
+                      std::span<NoteSink *const> sinks,
+                      const TranscriptionConfig &config = {});
 } // namespace basic_pitch
 
 #endif // BASIC_PITCH_HPP
@@ -0,0 +1,179 @@
+#include "basicpitch.hpp"
+#include "smf_encoder.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace basic_pitch::constants;
+using namespace basic_pitch::detail;
+
+namespace
+{
+double tick_to_time(uint32_t tick, int tempo_us)
+{
+    return static_cast<double>(tick) * tempo_us / (1'000'000.0 * DEFAULT_TPQN);
+}
+} // namespace
+
+basic_pitch::LiveTranscriber::LiveTranscriber(
+    MessageCallback on_message, const TranscriptionConfig &config)
+    : on_message_(std::move(on_message)), config_(config), tracker_(config)
+{
+}
+
+bool basic_pitch::LiveTranscriber::push_audio(const float *mono_audio,
+                                              int length)
+{
+    if (!ok_)
+    {
+        return false;
+    }
+    arrivals_.emplace_back(inference_.n_samples() + length, Clock::now());
+
+    inference_.push_audio(mono_audio, length,
+                          [this](const float *notes, const float *onsets,
+                                 const float *contours)
+                          { push_frame(notes, onsets, contours); });
+    if (!emit_finished())
+    {
+        return false;
+    }
+
+    // later notes start at or after the first open frame, so the audio
+    // before it no longer has messages to time
+    const double first_open_sample =
+        model_frame_to_time(tracker_.first_open_frame()) * SAMPLE_RATE;
+    std::size_t n_done = 0;
+    while (n_done + 1 < arrivals_.size() &&
+           arrivals_[n_done].first <= first_open_sample)
+    {
+        n_done++;
+    }
+    arrivals_.erase(arrivals_.begin(), arrivals_.begin() + n_done);
+    return true;
+}
+
+bool basic_pitch::LiveTranscriber::finish()
+{
+    if (ok_)
+    {
+        inference_.finish(
+            [this](const float *notes, const float *onsets,
+                   const float *contours)
+            { push_frame(notes, onsets, contours); });
+        tracker_.flush(finished_);
+        emit_finished();
+    }
+    else
+    {
+        inference_.finish([](const float *, const float *, const float *) {});
+        tracker_.flush(finished_);
+        finished_.clear();
+    }
+
+    bool ok = ok_;
+    ok_ = true;
+    arrivals_.clear();
+    return ok;
+}
+
+void basic_pitch::LiveTranscriber::push_frame(const float *notes,
+                                              const float *onsets,
+                                              const float *contours)
+{
+    tracker_.push_frame(notes, onsets, contours, finished_);
+}
+
+bool basic_pitch::LiveTranscriber::emit_finished()
+{
+    if (finished_.empty())
+    {
+        return ok_;
+    }
+
+    // the events of the finished notes, as note_events_to_midi sorts them
+    midi_events_.clear();
+    for (std::size_t i = 0; i < finished_.size(); ++i)
+    {
+        std::span<const int> pitch_bends = finished_.pitch_bends(i);
+        std::size_t n_events = midi_events_.size();
+        midi_events_.resize(n_events + 2 + pitch_bends.size());
+        n_events += note_midi_events(finished_[i], pitch_bends,
+                                     config_.midi_tempo_us,
+                                     config_.pitch_bend_tolerance,
+                                     midi_events_.data() + n_events);
+        midi_events_.resize(n_events);
+    }
+    finished_.clear();
+    sort_midi_events(midi_events_, scratch_);
+
+    for (uint64_t event : midi_events_)
+    {
+        LiveMidiMessage message;
+        message.tick = midi_event_tick(event);
+        message.time = tick_to_time(message.tick, config_.midi_tempo_us);
+        message.status = midi_event_status(midi_event_type(event));
+        message.data1 = static_cast<uint8_t>(event >> 8);
+        message.data2 = static_cast<uint8_t>(event);
+        message.latency_ms =
+            std::chrono::duration<double, std::milli>(
+                Clock::now() - arrival_time(message.time))
+                .count();
+
+        n_messages_++;
+        latency_sum_ms_ += message.latency_ms;
+        max_latency_ms_ = std::max(max_latency_ms_, message.latency_ms);
+        if (!on_message_(message))
+        {
+            ok_ = false;
+            return false;
+        }
+    }
+    return true;
+}
+
+basic_pitch::LiveTranscriber::Clock::time_point
+basic_pitch::LiveTranscriber::arrival_time(double time) const
+{
+    // the piece of audio the sample at `time` came in, or the last one for
+    // a note off at the very end
+    const double sample = time * SAMPLE_RATE;
+    auto it = std::upper_bound(
+        arrivals_.begin(), arrivals_.end(), sample,
+        [](double s, const std::pair<int64_t, Clock::time_point> &arrival)
+        { return s < arrival.first; });
+    return it != arrivals_.end() ? it->second : arrivals_.back().second;
+}
+
+basic_pitch::LiveTranscriber::MessageCallback
+basic_pitch::live_message_writer(int fd)
+{
+    return [fd](const LiveMidiMessage &message)
+    {
+        char line[96];
+        int length = std::snprintf(
+            line, sizeof(line), "%.6f %u %02x %02x %02x %.3f\n", message.time,
+            message.tick, message.status, message.data1, message.data2,
+            message.latency_ms);
+
+        // lines shorter than PIPE_BUF are written whole to a pipe or FIFO
+        const char *data = line;
+        while (length > 0)
+        {
+            ssize_t written = ::write(fd, data, length);
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                std::cerr << "Error: unable to write live MIDI messages"
+                          << std::endl;
+                return false;
+            }
+            data += written;
+            length -= static_cast<int>(written);
+        }
+        return true;
+    };
+}
@@ -1,37 +1,42 @@
 #include "basicpitch.hpp"
+#include "pitch_bends.hpp"
+#include "smf_encoder.hpp"
 #include <algorithm>
+#include <cassert>
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
-#include <libremidi/libremidi.hpp>
-#include <libremidi/writer.hpp>
-#include <map>
-#include <numeric>
-#include <ranges>
-#include <sstream>
+#include <limits>
 #include <tuple>
 #include <vector>
 
 using namespace basic_pitch::constants;
+using namespace basic_pitch::detail;
 
+// onset_thresh is in the scale of the stored onsets
+// peaks in the bins [freq_begin, freq_end), with frequencies relative to
+// freq_begin
+template <typename T>
 static std::vector<std::pair<int, int>>
-find_peaks(const Eigen::Tensor2dXf &onsets)
+find_peaks(const Eigen::Tensor<T, 2> &onsets, float onset_thresh,
+           int freq_begin, int freq_end)
 {
     std::vector<std::pair<int, int>> peaks;
 
     // Get the dimensions of the onsets tensor
     int n_times = onsets.dimension(0); // Number of time steps (rows)
-    int n_freqs = onsets.dimension(1); // Number of frequency bins (columns)
+    int n_freqs = freq_end - freq_begin; // Number of frequency bins searched
 
     // Loop through the tensor to find peaks
     for (int t = 1; t < n_times - 1; ++t)
     {
         for (int f = 0; f < n_freqs; ++f)
         {
+            const T onset = onsets(t, freq_begin + f);
+
             // Check if the current element is a peak and exceeds the threshold
-            if (onsets(t, f) > ONSET_THRESHOLD &&
-                onsets(t, f) > onsets(t - 1, f) &&
-                onsets(t, f) > onsets(t + 1, f))
+            if (onset > onset_thresh && onset > onsets(t - 1, freq_begin + f) &&
+                onset > onsets(t + 1, freq_begin + f))
             {
 
                 peaks.emplace_back(t, f); // Store the peak (time, frequency)
@@ -42,38 +47,81 @@ find_peaks(const Eigen::Tensor2dXf &onsets)
     return peaks;
 }
 
-static std::vector<float> model_frames_to_time(int n_frames)
+// Same as above over sparse onsets. Cells below the floor are below the
+// threshold, so only the stored runs are scanned; a missing neighbour is
+// below the floor and hence below any peak
+static std::vector<std::pair<int, int>>
+find_peaks(const basic_pitch::SparseActivations &onsets, float onset_thresh,
+           int freq_begin, int freq_end)
 {
-    std::vector<float> times(n_frames);
-
-    float original_time_factor =
-        static_cast<float>(FFT_HOP) / static_cast<float>(SAMPLE_RATE);
-    float window_factor = 1.0f / static_cast<float>(ANNOT_N_FRAMES);
-    float window_offset =
-        original_time_factor * (static_cast<float>(ANNOT_N_FRAMES) -
-                                (static_cast<float>(AUDIO_N_SAMPLES) /
-                                 static_cast<float>(FFT_HOP))) +
-        0.0018f;
+    std::vector<std::pair<int, int>> peaks;
 
-    for (int i = 0; i < n_frames; ++i)
+    for (int f = 0; f < freq_end - freq_begin; ++f)
     {
-        float frame_index = static_cast<float>(i);
-        float original_time = frame_index * original_time_factor;
-        float window_number = frame_index * window_factor;
-        times[i] = original_time - (window_offset * window_number);
+        const int bin = freq_begin + f;
+        for (int r = onsets.bin_runs[bin]; r < onsets.bin_runs[bin + 1]; ++r)
+        {
+            const float *run = onsets.values.data() + onsets.run_values[r];
+            int run_start = onsets.run_start[r];
+            int run_length = onsets.run_length(r);
+
+            for (int j = 0; j < run_length; ++j)
+            {
+                int t = run_start + j;
+                if (t < 1 || t >= onsets.n_frames - 1)
+                {
+                    continue;
+                }
+
+                float prev = j > 0 ? run[j - 1] : 0.0f;
+                float next = j + 1 < run_length ? run[j + 1] : 0.0f;
+                if (run[j] > onset_thresh && run[j] > prev && run[j] > next)
+                {
+                    peaks.emplace_back(t, f);
+                }
+            }
+        }
     }
 
-    return times;
+    // the same (time, frequency) order as the dense scan
+    std::sort(peaks.begin(), peaks.end());
+    return peaks;
+}
+
+// in double precision, like the reference implementation, so that the
+// ticks rounded from it do not depend on how the compiler contracts the
+// float arithmetic
+double basic_pitch::model_frame_to_time(int frame)
+{
+    double original_time_factor =
+        static_cast<double>(FFT_HOP) / static_cast<double>(SAMPLE_RATE);
+    double window_factor = 1.0 / static_cast<double>(ANNOT_N_FRAMES);
+    double window_offset =
+        original_time_factor * (static_cast<double>(ANNOT_N_FRAMES) -
+                                (static_cast<double>(AUDIO_N_SAMPLES) /
+                                 static_cast<double>(FFT_HOP))) +
+        0.0018;
+
+    double frame_index = static_cast<double>(frame);
+    double original_time = frame_index * original_time_factor;
+    double window_number = frame_index * window_factor;
+    return original_time - (window_offset * window_number);
 }
 
+// frame_thresh is in the scale of the stored frames, the amplitudes are
+// scaled back to [0, 1]; column 0 holds the MIDI pitch pitch_offset
+template <typename T>
 static void
-apply_melodia_trick(Eigen::MatrixXf &remaining_energy,
-                    const Eigen::MatrixXf &frames, float frame_thresh,
-                    int energy_tol, int min_note_len,
-                    std::vector<basic_pitch::NoteEvent> &note_events)
+apply_melodia_trick(Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic,
+                                             Eigen::Dynamic>> remaining_energy,
+                    Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic,
+                                                   Eigen::Dynamic>> frames,
+                    float frame_thresh, int energy_tol, int min_note_len,
+                    int pitch_offset, basic_pitch::NoteEventList &note_events)
 {
 
     int n_times = remaining_energy.rows();
+    const Eigen::Index max_freq_idx = remaining_energy.cols() - 1;
 
     // Continue applying the trick as long as there is energy above the
     // threshold
@@ -81,10 +129,10 @@ apply_melodia_trick(Eigen::MatrixXf &remaining_energy,
     {
         // Find the time-frequency point with maximum remaining energy
         Eigen::Index i_mid, freq_idx;
-        float max_energy = remaining_energy.maxCoeff(&i_mid, &freq_idx);
+        remaining_energy.maxCoeff(&i_mid, &freq_idx);
 
         // Zero out the max energy point
-        remaining_energy(i_mid, freq_idx) = 0.0f;
+        remaining_energy(i_mid, freq_idx) = T(0);
 
         // Forward pass to find note end
         int i = i_mid + 1;
@@ -99,13 +147,13 @@ apply_melodia_trick(Eigen::MatrixXf &remaining_energy,
             {
                 k = 0;
             }
-            remaining_energy(i, freq_idx) = 0.0f;
+            remaining_energy(i, freq_idx) = T(0);
 
             // Zero out neighboring frequencies if applicable
-            if (freq_idx < MAX_FREQ_IDX)
-                remaining_energy(i, freq_idx + 1) = 0.0f;
+            if (freq_idx < max_freq_idx)
+                remaining_energy(i, freq_idx + 1) = T(0);
             if (freq_idx > 0)
-                remaining_energy(i, freq_idx - 1) = 0.0f;
+                remaining_energy(i, freq_idx - 1) = T(0);
 
             i++;
         }
@@ -124,13 +172,13 @@ apply_melodia_trick(Eigen::MatrixXf &remaining_energy,
             {
                 k = 0;
             }
-            remaining_energy(i, freq_idx) = 0.0f;
+            remaining_energy(i, freq_idx) = T(0);
 
             // Zero out neighboring frequencies if applicable
-            if (freq_idx < MAX_FREQ_IDX)
-                remaining_energy(i, freq_idx + 1) = 0.0f;
+            if (freq_idx < max_freq_idx)
+                remaining_energy(i, freq_idx + 1) = T(0);
             if (freq_idx > 0)
-                remaining_energy(i, freq_idx - 1) = 0.0f;
+                remaining_energy(i, freq_idx - 1) = T(0);
 
             i--;
         }
@@ -149,146 +197,324 @@ apply_melodia_trick(Eigen::MatrixXf &remaining_energy,
             amplitude += frames(t, freq_idx);
         }
         amplitude /= (i_end - i_start);
+        amplitude /= basic_pitch::posteriorgram_scale<T>();
 
         // Store note event (start, end, MIDI pitch, amplitude)
-        note_events.emplace_back(i_start, i_end, freq_idx + MIDI_OFFSET,
-                                 amplitude, std::nullopt);
+        note_events.push_back({i_start, i_end,
+                               static_cast<int>(freq_idx) + pitch_offset,
+                               amplitude});
     }
 }
 
-// Convert MIDI pitch to frequency (Hz)
-static float midi_to_hz(float pitch_midi)
+// Same as above over sparse frames, with remaining_energy holding the
+// remaining energy of each stored cell. Instead of searching the whole
+// matrix for its maximum on every note, the cells above the threshold are
+// visited from a max-heap in the order maxCoeff would find them, skipping
+// those that were zeroed in the meantime.
+static void
+apply_melodia_trick(const basic_pitch::SparseActivations &frames,
+                    std::vector<float> &remaining_energy, float frame_thresh,
+                    int energy_tol, int min_note_len, int freq_begin,
+                    int freq_end, int pitch_offset,
+                    basic_pitch::NoteEventList &note_events)
 {
-    return 440.0f *
-           std::pow(2.0f, (pitch_midi - 69.0f) / 12.0f); // A4 is 440Hz, MIDI 69
-}
+    struct Cell
+    {
+        float energy;
+        int freq_idx;
+        int t;
+        int index;
+    };
 
-static float midi_pitch_to_contour_bin(float pitch_midi)
-{
-    // Convert MIDI pitch to frequency (Hz)
-    float pitch_hz = midi_to_hz(pitch_midi);
+    // highest energy first, ties go to the lowest frequency, then the lowest
+    // frame, like a column-major maxCoeff
+    auto heap_order = [](const Cell &a, const Cell &b)
+    {
+        return std::tie(a.energy, b.freq_idx, b.t) <
+               std::tie(b.energy, a.freq_idx, a.t);
+    };
 
-    // Calculate the corresponding bin in the contour matrix
-    return 12.0f * CONTOURS_BINS_PER_SEMITONE *
-           std::log2(pitch_hz / ANNOTATIONS_BASE_FREQUENCY);
-}
+    // frequencies are relative to freq_begin
+    const int max_freq_idx = freq_end - freq_begin - 1;
 
-static void add_pitch_bends(const Eigen::Tensor2dXf &contours,
-                            std::vector<basic_pitch::NoteEvent> &note_events,
-                            int n_bins_tolerance = 25)
-{
-    int n_freqs_contours = contours.dimension(1);
-    const int window_length = n_bins_tolerance * 2 + 1;
-
-    // Create Gaussian window similar to scipy.signal.windows.gaussian
-    std::vector<float> freq_gaussian(window_length);
-    float sigma = 5.0f;
-    for (int i = 0; i < window_length; ++i)
+    std::vector<Cell> heap;
+    for (int f = 0; f <= max_freq_idx; ++f)
     {
-        float x = static_cast<float>(i - n_bins_tolerance);
-        freq_gaussian[i] = std::exp(-(x * x) / (2 * sigma * sigma));
+        const int bin = freq_begin + f;
+        for (int r = frames.bin_runs[bin]; r < frames.bin_runs[bin + 1]; ++r)
+        {
+            for (int j = 0; j < frames.run_length(r); ++j)
+            {
+                int index = frames.run_values[r] + j;
+                if (remaining_energy[index] > frame_thresh)
+                {
+                    heap.push_back({remaining_energy[index], f,
+                                    frames.run_start[r] + j, index});
+                }
+            }
+        }
     }
+    std::make_heap(heap.begin(), heap.end(), heap_order);
 
-    for (auto &note_event : note_events)
+    auto clear = [&](int t, int f)
     {
-        auto &[start_idx, end_idx, pitch_midi, amplitude, pitch_bends] =
-            note_event;
-
-        float bin_float =
-            midi_pitch_to_contour_bin(static_cast<float>(pitch_midi));
-        int freq_idx = static_cast<int>(std::round(bin_float));
-
-        // Ensure frequency indices are within valid bounds
-        int freq_start_idx = std::max(0, freq_idx - n_bins_tolerance);
-        int freq_end_idx =
-            std::min(n_freqs_contours, freq_idx + n_bins_tolerance + 1);
-
-        // Adjust Gaussian window bounds to handle boundary conditions
-        int gaussian_start = std::max(0, n_bins_tolerance - freq_idx);
-        int gaussian_end =
-            window_length -
-            std::max(0, freq_idx - (n_freqs_contours - n_bins_tolerance - 1));
-
-        // Shift factor for calculating relative bends
-        int pb_shift =
-            n_bins_tolerance - std::max(0, n_bins_tolerance - freq_idx);
-
-        // Initialize pitch_bends only if needed
-        pitch_bends
-            .emplace(); // Initializes the std::optional with an empty vector
-        pitch_bends->resize(end_idx -
-                            start_idx); // Resize the vector within the optional
-
-        // Apply Gaussian window and extract submatrix, performing element-wise
-        // multiplication
-        for (int t = start_idx; t < end_idx; ++t)
+        int index = frames.find(t, freq_begin + f);
+        if (index >= 0)
+            remaining_energy[index] = 0.0f;
+    };
+    auto energy = [&](int t, int f)
+    {
+        int index = frames.find(t, freq_begin + f);
+        return index < 0 ? 0.0f : remaining_energy[index];
+    };
+
+    int n_times = frames.n_frames;
+
+    while (!heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end(), heap_order);
+        Cell cell = heap.back();
+        heap.pop_back();
+
+        // skip cells zeroed since they were queued
+        if (remaining_energy[cell.index] != cell.energy)
         {
-            float max_val = -std::numeric_limits<float>::infinity();
-            int max_idx = 0;
+            continue;
+        }
 
-            // Loop within the Gaussian window limits: from `gaussian_start` to
-            // `gaussian_end`
-            for (int f = freq_start_idx, g = gaussian_start;
-                 f < freq_end_idx && g < gaussian_end; ++f, ++g)
+        int i_mid = cell.t;
+        int freq_idx = cell.freq_idx;
+
+        // Zero out the max energy point
+        remaining_energy[cell.index] = 0.0f;
+
+        // Forward pass to find note end
+        int i = i_mid + 1;
+        int k = 0;
+        while (i < n_times - 1 && k < energy_tol)
+        {
+            if (energy(i, freq_idx) < frame_thresh)
             {
-                // Apply Gaussian window to each frequency bin in the current
-                // frame
-                float weighted_value = contours(t, f) * freq_gaussian[g];
-                if (weighted_value > max_val)
-                {
-                    max_val = weighted_value;
-                    max_idx = f; // Store the actual frequency bin index
-                }
+                k++;
+            }
+            else
+            {
+                k = 0;
+            }
+            clear(i, freq_idx);
+
+            // Zero out neighboring frequencies if applicable
+            if (freq_idx < max_freq_idx)
+                clear(i, freq_idx + 1);
+            if (freq_idx > 0)
+                clear(i, freq_idx - 1);
+
+            i++;
+        }
+        int i_end = i - 1 - k;
+
+        // Backward pass to find note start
+        i = i_mid - 1;
+        k = 0;
+        while (i > 0 && k < energy_tol)
+        {
+            if (energy(i, freq_idx) < frame_thresh)
+            {
+                k++;
             }
+            else
+            {
+                k = 0;
+            }
+            clear(i, freq_idx);
+
+            // Zero out neighboring frequencies if applicable
+            if (freq_idx < max_freq_idx)
+                clear(i, freq_idx + 1);
+            if (freq_idx > 0)
+                clear(i, freq_idx - 1);
 
-            // Normalize the max index relative to the Gaussian window center
-            (*pitch_bends)[t - start_idx] =
-                (max_idx - freq_start_idx) - pb_shift;
+            i--;
         }
+        int i_start = i + 1 + k;
+
+        // Ensure the note is long enough
+        if (i_end - i_start <= min_note_len)
+        {
+            continue; // Skip short notes
+        }
+
+        // Calculate amplitude and store the new note event
+        float amplitude = 0.0f;
+        for (int t = i_start; t < i_end; ++t)
+        {
+            amplitude += frames(t, freq_begin + freq_idx);
+        }
+        amplitude /= (i_end - i_start);
+
+        note_events.push_back(
+            {i_start, i_end, freq_idx + pitch_offset, amplitude});
     }
 }
 
-// Function to drop pitch bends from overlapping notes
-static void
-drop_overlapping_pitch_bends(std::vector<basic_pitch::NoteEvent> &note_events)
+void basic_pitch::drop_overlapping_pitch_bends(
+    basic_pitch::NoteEventList &note_events)
 {
     // Sort by start time
-    std::sort(note_events.begin(), note_events.end());
-
-    for (size_t i = 0; i < note_events.size() - 1; ++i)
+    note_events.sort();
+
+    // Sweep the notes in start order: the only thing that matters about the
+    // notes still active is the latest end time among them. A note overlaps
+    // an earlier note if it starts before that end time, and a later note if
+    // the next note starts before it ends.
+    int latest_end = std::numeric_limits<int>::min();
+    const std::vector<int> &start_idx = note_events.start_idx;
+    const std::vector<int> &end_idx = note_events.end_idx;
+    for (size_t i = 0; i < note_events.size(); ++i)
     {
-        for (size_t j = i + 1; j < note_events.size(); ++j)
+        bool overlaps_previous = start_idx[i] < latest_end;
+        bool overlaps_next =
+            i + 1 < note_events.size() && start_idx[i + 1] < end_idx[i];
+
+        latest_end = std::max(latest_end, end_idx[i]);
+
+        // Remove pitch bends from overlapping notes
+        if (overlaps_previous || overlaps_next)
         {
-            // Check if start time of note j is after end time of note i
-            if ((note_events[j].start_idx) >= (note_events[i].end_idx))
-            {
-                break; // No overlap
-            }
+            note_events.drop_pitch_bends(i);
+        }
+    }
+}
+
+int basic_pitch::PitchRange::contour_bin_begin() const
+{
+    return std::max(0, midi_pitch_to_contour_bin(min_pitch) -
+                           PITCH_BEND_TOLERANCE_BINS);
+}
+
+int basic_pitch::PitchRange::contour_bin_end() const
+{
+    return std::min(N_FREQ_BINS_CONTOURS, midi_pitch_to_contour_bin(max_pitch) +
+                                              PITCH_BEND_TOLERANCE_BINS + 1);
+}
+
+// the pitches to track: those requested that are stored, possibly none
+static basic_pitch::PitchRange
+tracked_pitches(const basic_pitch::PitchRange &stored,
+                const basic_pitch::PitchRange &requested)
+{
+    return {std::max(stored.min_pitch, requested.min_pitch),
+            std::min(stored.max_pitch, requested.max_pitch)};
+}
+
+// Pitch bend window of a note in the stored contour bins of contour_range
+static PitchBendWindow
+note_pitch_bend_window(int pitch_midi,
+                       const basic_pitch::PitchRange &contour_range)
+{
+    const int contour_begin = contour_range.contour_bin_begin();
+    PitchBendWindow window = pitch_bend_window(pitch_midi);
+    window.freq_start_idx -= contour_begin;
+    window.freq_end_idx -= contour_begin;
+    return window;
+}
+
+// one arena allocation for the bends of all notes
+static void reserve_pitch_bend_arena(basic_pitch::NoteEventList &note_events)
+{
+    std::size_t n_bends = 0;
+    for (std::size_t i = 0; i < note_events.size(); ++i)
+    {
+        n_bends += note_events.end_idx[i] - note_events.start_idx[i];
+    }
+    note_events.pitch_bend_arena.reserve(note_events.pitch_bend_arena.size() +
+                                         n_bends);
+}
+
+template <typename T>
+void basic_pitch::add_pitch_bends(const Eigen::Tensor<T, 2> &contours,
+                                  basic_pitch::NoteEventList &note_events,
+                                  const basic_pitch::PitchRange &contour_range)
+{
+    // contours of another width would be searched in the wrong bins
+    assert(contours.dimension(1) == contour_range.n_contour_bins());
+
+    int n_times_contours = contours.dimension(0);
+
+    // scratch space for the weighted argmax, sized for the longest note
+    std::vector<float> max_val;
+    std::vector<int> max_idx;
+
+    reserve_pitch_bend_arena(note_events);
+
+    for (std::size_t i = 0; i < note_events.size(); ++i)
+    {
+        int start_idx = note_events.start_idx[i];
+        int end_idx = note_events.end_idx[i];
+        int pitch_midi = note_events.pitch[i];
+
+        const PitchBendWindow window =
+            note_pitch_bend_window(pitch_midi, contour_range);
 
-            // Remove pitch bends from overlapping notes
-            note_events[i].pitch_bends = std::nullopt;
-            note_events[j].pitch_bends = std::nullopt;
+        int n_frames = end_idx - start_idx;
+        if (static_cast<int>(max_val.size()) < n_frames)
+        {
+            max_val.resize(n_frames);
+            max_idx.resize(n_frames);
         }
+
+        // one pitch bend per frame of the note
+        int *pitch_bends = note_events.assign_pitch_bends(i, n_frames);
+
+        // the contours are column-major, so each contour bin is a contiguous
+        // run of the note's frames
+        pitch_bends_column_major(&contours(start_idx, 0), n_times_contours,
+                                 n_frames, window, max_val.data(),
+                                 max_idx.data(), pitch_bends);
     }
+
+    // Drop pitch bends from overlapping notes
+    basic_pitch::drop_overlapping_pitch_bends(note_events);
 }
 
 // Main function to convert frames and onsets to note events
-static std::vector<basic_pitch::NoteEvent>
-output_to_notes_polyphonic(const basic_pitch::InferenceResult &inference_result,
-                           const bool use_melodia_trick,
-                           const bool include_pitch_bends)
+template <typename T>
+basic_pitch::NoteEventList basic_pitch::output_to_notes_polyphonic(
+    const basic_pitch::BasicInferenceResult<T> &inference_result,
+    const basic_pitch::TranscriptionConfig &config)
 {
+    using Matrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+
+    // thresholds in the scale of the stored activations
+    const float scale = posteriorgram_scale<T>();
+    const float onset_thresh = config.onset_threshold * scale;
+    const float frame_thresh = config.frame_threshold * scale;
 
     int n_times_onsets = inference_result.onsets.dimension(0);
+    basic_pitch::NoteEventList note_events;
+
+    // only the columns of the tracked pitches are searched and copied
+    const basic_pitch::PitchRange pitches =
+        tracked_pitches(inference_result.pitch_range, config.pitch_range);
+    if (pitches.n_pitches() <= 0)
+    {
+        return note_events;
+    }
+    const int freq_begin =
+        pitches.min_pitch - inference_result.pitch_range.min_pitch;
+    const int n_freqs = pitches.n_pitches();
+    const int max_freq_idx = n_freqs - 1;
 
-    Eigen::Tensor2dXf frames = inference_result.notes;
+    Eigen::Map<const Matrix> frames(inference_result.notes.data() +
+                                        freq_begin * n_times_onsets,
+                                    n_times_onsets, n_freqs);
 
-    Eigen::Tensor2dXf remaining_energy =
+    Matrix remaining_energy =
         frames; // Clone frames as we will modify this in-place
-    std::vector<basic_pitch::NoteEvent> note_events;
 
     // Find peaks in the onsets
-    auto peaks = find_peaks(inference_result.onsets);
+    auto peaks = find_peaks(inference_result.onsets, onset_thresh, freq_begin,
+                            freq_begin + n_freqs);
 
     // reverse sort the peaks by onset value
     // std::sort(filtered_peaks.begin(), filtered_peaks.end(),
@@ -302,9 +528,9 @@ output_to_notes_polyphonic(const basic_pitch::InferenceResult &inference_result,
         int k = 0;
 
         // Find the point where the note energy drops below the threshold
-        while (i < n_times_onsets - 1 && k < ENERGY_TOL)
+        while (i < n_times_onsets - 1 && k < config.energy_tol)
         {
-            if (remaining_energy(i, freq_idx) < FRAME_THRESHOLD)
+            if (remaining_energy(i, freq_idx) < frame_thresh)
             {
                 k++;
             }
@@ -316,17 +542,17 @@ output_to_notes_polyphonic(const basic_pitch::InferenceResult &inference_result,
         }
         i -= k; // Adjust index
 
-        if (i - note_start_idx <= MIN_NOTE_LEN)
+        if (i - note_start_idx <= config.min_note_len)
             continue; // Skip short notes
 
         // Clear energy in the current frequency band
         for (int t = note_start_idx; t < i; ++t)
         {
-            remaining_energy(t, freq_idx) = 0.0f;
+            remaining_energy(t, freq_idx) = T(0);
             if (freq_idx > 0)
-                remaining_energy(t, freq_idx - 1) = 0.0f;
-            if (freq_idx < MAX_FREQ_IDX)
-                remaining_energy(t, freq_idx + 1) = 0.0f;
+                remaining_energy(t, freq_idx - 1) = T(0);
+            if (freq_idx < max_freq_idx)
+                remaining_energy(t, freq_idx + 1) = T(0);
         }
 
         // Calculate amplitude and store note event
@@ -336,211 +562,446 @@ output_to_notes_polyphonic(const basic_pitch::InferenceResult &inference_result,
             amplitude += frames(t, freq_idx);
         }
         amplitude /= (i - note_start_idx);
+        amplitude /= scale;
 
-        note_events.emplace_back(note_start_idx, i, freq_idx + MIDI_OFFSET,
-                                 amplitude, std::nullopt);
+        note_events.push_back(
+            {note_start_idx, i, freq_idx + pitches.min_pitch, amplitude});
     }
 
-    if (use_melodia_trick)
+    // an empty input has no maximum to start from
+    if (config.use_melodia_trick && n_times_onsets > 0)
     {
-        // get matrixxf of remaining_energy, frames to apply melodia trick
-        Eigen::MatrixXf remaining_energy_mat = Eigen::Map<Eigen::MatrixXf>(
-            remaining_energy.data(), remaining_energy.dimension(0),
-            remaining_energy.dimension(1));
-        Eigen::MatrixXf frames_mat = Eigen::Map<Eigen::MatrixXf>(
-            frames.data(), frames.dimension(0), frames.dimension(1));
-        apply_melodia_trick(remaining_energy_mat, frames_mat, FRAME_THRESHOLD,
-                            ENERGY_TOL, MIN_NOTE_LEN, note_events);
+        Eigen::Map<Matrix> remaining_energy_mat(remaining_energy.data(),
+                                                remaining_energy.rows(),
+                                                remaining_energy.cols());
+        apply_melodia_trick<T>(remaining_energy_mat, frames, frame_thresh,
+                               config.energy_tol, config.min_note_len,
+                               pitches.min_pitch, note_events);
     }
 
-    if (include_pitch_bends)
-    {
-        add_pitch_bends(inference_result.contours, note_events);
-    }
     return note_events;
 }
 
-static uint32_t time_to_ticks(float time_seconds, int tempo_us,
-                              int tpqn = DEFAULT_TPQN)
+void basic_pitch::add_pitch_bends(const SparseActivations &contours,
+                                  basic_pitch::NoteEventList &note_events,
+                                  const PitchRange &contour_range)
 {
-    return static_cast<uint32_t>(
-        std::round((time_seconds * tpqn * 1'000'000) / tempo_us));
-}
+    assert(contours.n_bins == contour_range.n_contour_bins());
 
-static libremidi::writer
-note_events_to_midi(const std::vector<basic_pitch::NoteEvent> &note_events,
-                    int n_times_onsets)
-{
+    // the window of each note is made dense, with zeros below the floor, and
+    // run through the same kernel as the dense contours
+    std::vector<float> window_values;
+    std::vector<float> max_val;
+    std::vector<int> max_idx;
+
+    reserve_pitch_bend_arena(note_events);
 
-    libremidi::writer midi_writer;
-    midi_writer.ticksPerQuarterNote = DEFAULT_TPQN;
+    for (std::size_t i = 0; i < note_events.size(); ++i)
+    {
+        int start_idx = note_events.start_idx[i];
+        int end_idx = note_events.end_idx[i];
+        int pitch_midi = note_events.pitch[i];
+
+        const PitchBendWindow window =
+            note_pitch_bend_window(pitch_midi, contour_range);
+
+        int n_frames = end_idx - start_idx;
+        int n_window_bins = window.freq_end_idx - window.freq_start_idx;
+        window_values.assign(static_cast<std::size_t>(n_frames) *
+                                 n_window_bins,
+                             0.0f);
+        for (int b = 0; b < n_window_bins; ++b)
+        {
+            contours.copy_bin(window.freq_start_idx + b, start_idx, end_idx,
+                              window_values.data() + b * n_frames);
+        }
+        if (static_cast<int>(max_val.size()) < n_frames)
+        {
+            max_val.resize(n_frames);
+            max_idx.resize(n_frames);
+        }
 
-    // Track with tempo and time signature
-    libremidi::midi_track meta_track;
-    meta_track.emplace_back(0, 0, libremidi::meta_events::tempo(MIDI_TEMPO_US));
-    meta_track.emplace_back(
-        0, 0,
-        libremidi::meta_events::time_signature(TIME_SIGNATURE_NUMERATOR,
-                                               TIME_SIGNATURE_DENOMINATOR));
-    midi_writer.tracks.push_back(meta_track);
+        // the scratch window starts at the first bin of the window
+        PitchBendWindow local_window = window;
+        local_window.freq_start_idx = 0;
+        local_window.freq_end_idx = n_window_bins;
 
-    // Calculate frame times for each note onset
-    std::vector<float> frame_times = model_frames_to_time(n_times_onsets);
+        int *pitch_bends = note_events.assign_pitch_bends(i, n_frames);
+        pitch_bends_column_major(window_values.data(), n_frames, n_frames,
+                                 local_window, max_val.data(), max_idx.data(),
+                                 pitch_bends);
+    }
+
+    // Drop pitch bends from overlapping notes
+    basic_pitch::drop_overlapping_pitch_bends(note_events);
+}
 
-    // Create a vector to hold all events with their absolute tick times
-    struct MidiEvent
+basic_pitch::NoteEventList basic_pitch::output_to_notes_polyphonic(
+    const basic_pitch::SparseInferenceResult &inference_result,
+    const basic_pitch::TranscriptionConfig &config)
+{
+    const basic_pitch::SparseActivations &frames = inference_result.notes;
+    int n_times_onsets = inference_result.onsets.n_frames;
+    basic_pitch::NoteEventList note_events;
+
+    const basic_pitch::PitchRange pitches =
+        tracked_pitches(inference_result.pitch_range, config.pitch_range);
+    if (pitches.n_pitches() <= 0)
     {
-        uint32_t tick; // Absolute tick time
-        libremidi::message message;
-    };
+        return note_events;
+    }
+    const int freq_begin =
+        pitches.min_pitch - inference_result.pitch_range.min_pitch;
+    const int freq_end = freq_begin + pitches.n_pitches();
+    const int max_freq_idx = pitches.n_pitches() - 1;
 
-    std::vector<MidiEvent> midi_events;
+    // remaining energy of each stored cell of frames
+    std::vector<float> remaining_energy = frames.values;
 
-    std::cout << "Before iterating over note events" << std::endl;
+    // Find peaks in the onsets
+    auto peaks = find_peaks(inference_result.onsets, config.onset_threshold,
+                            freq_begin, freq_end);
 
-    // Iterate over note events
-    for (const auto &[start_idx, end_idx, pitch, amplitude, pitch_bend_opt] :
-         note_events)
+    // latest onsets first, like the dense path
+    std::reverse(peaks.begin(), peaks.end());
+
+    for (const auto &[note_start_idx, freq_idx] : peaks)
     {
-        float start_time = frame_times[start_idx];
-        float end_time = frame_times[end_idx];
-        uint32_t start_tick = time_to_ticks(start_time, MIDI_TEMPO_US);
-        uint32_t end_tick = time_to_ticks(end_time, MIDI_TEMPO_US);
-        int velocity = static_cast<int>(amplitude * 127);
-
-        // Add `Note_on` event at start_tick
-        midi_events.push_back({start_tick, libremidi::channel_events::note_on(
-                                               0, pitch, velocity)});
-
-        // Process pitch bends directly without allocating a sub-vector
-        if (pitch_bend_opt.has_value())
-        {
-            const std::vector<int> &pitch_bend = pitch_bend_opt.value();
-            int num_bends = pitch_bend.size();
+        int i = note_start_idx + 1;
+        int k = 0;
 
-            if (num_bends > 1)
+        // Find the point where the note energy drops below the threshold
+        while (i < n_times_onsets - 1 && k < config.energy_tol)
+        {
+            int index = frames.find(i, freq_begin + freq_idx);
+            float energy = index < 0 ? 0.0f : remaining_energy[index];
+            if (energy < config.frame_threshold)
             {
-                float time_increment =
-                    (end_time - start_time) / (num_bends - 1);
-
-                for (int i = 0; i < num_bends; ++i)
-                {
-                    float bend_time = start_time + i * time_increment;
-                    uint32_t bend_tick =
-                        time_to_ticks(bend_time, MIDI_TEMPO_US);
-
-                    // Ensure bend_tick does not exceed end_tick
-                    bend_tick = std::min(bend_tick, end_tick);
-
-                    int bend_value =
-                        pitch_bend[i] * (4096 / CONTOURS_BINS_PER_SEMITONE) +
-                        8192;
-                    bend_value = std::clamp(bend_value, 0, 16383);
-
-                    // Add pitch bend event at bend_tick
-                    midi_events.push_back(
-                        {bend_tick,
-                         libremidi::channel_events::pitch_bend(0, bend_value)});
-                }
+                k++;
             }
             else
             {
-                // Single pitch bend case
-                uint32_t bend_tick = start_tick;
-                int bend_value =
-                    pitch_bend[0] * (4096 / CONTOURS_BINS_PER_SEMITONE) + 8192;
-                bend_value = std::clamp(bend_value, 0, 16383);
-
-                // Add pitch bend event at start_tick
-                midi_events.push_back(
-                    {bend_tick,
-                     libremidi::channel_events::pitch_bend(0, bend_value)});
+                k = 0;
+            }
+            i++;
+        }
+        i -= k; // Adjust index
+
+        if (i - note_start_idx <= config.min_note_len)
+            continue; // Skip short notes
+
+        // Clear energy in the current and neighbouring frequency bands
+        for (int f = std::max(0, freq_idx - 1);
+             f <= std::min(max_freq_idx, freq_idx + 1); ++f)
+        {
+            for (int t = note_start_idx; t < i; ++t)
+            {
+                int index = frames.find(t, freq_begin + f);
+                if (index >= 0)
+                    remaining_energy[index] = 0.0f;
             }
         }
 
-        // Add `Note_off` event at end_tick
-        midi_events.push_back(
-            {end_tick, libremidi::channel_events::note_off(0, pitch, 0)});
+        // Calculate amplitude and store note event
+        float amplitude = 0.0f;
+        for (int t = note_start_idx; t < i; ++t)
+        {
+            amplitude += frames(t, freq_begin + freq_idx);
+        }
+        amplitude /= (i - note_start_idx);
+
+        note_events.push_back(
+            {note_start_idx, i, freq_idx + pitches.min_pitch, amplitude});
+    }
+
+    if (config.use_melodia_trick)
+    {
+        apply_melodia_trick(frames, remaining_energy, config.frame_threshold,
+                            config.energy_tol, config.min_note_len, freq_begin,
+                            freq_end, pitches.min_pitch, note_events);
     }
 
-    std::cout << "After iterating over note events" << std::endl;
-
-    // Sort all events by their absolute tick times
-    std::sort(midi_events.begin(), midi_events.end(),
-              [](const MidiEvent &a, const MidiEvent &b)
-              {
-                  if (a.tick != b.tick)
-                  {
-                      return a.tick < b.tick; // Primary sorting by tick
-                  }
-                  else
-                  {
-                      // Secondary sorting by message type
-                      return a.message.get_message_type() <
-                             b.message.get_message_type();
-                  }
-              });
-
-    std::cout << "Now creating instrument track" << std::endl;
-
-    // Now, compute delta times and add events to the instrument track
-    libremidi::midi_track instrument_track;
-    instrument_track.emplace_back(0, 0,
-                                  libremidi::channel_events::program_change(
-                                      0, 4)); // Set program to Electric Piano
-
-    uint32_t last_tick = 0;
-    for (const auto &event : midi_events)
+    return note_events;
+}
+
+int basic_pitch::tempo_bpm_to_us(float bpm)
+{
+    // checked before rounding, as the cast of an out-of-range double is
+    // undefined; NaN fails both comparisons
+    double tempo_us = 60e6 / bpm;
+    if (!(bpm > 0.0f && tempo_us >= 0.5 && tempo_us < MAX_MIDI_TEMPO_US + 0.5))
     {
-        uint32_t delta_ticks = event.tick - last_tick;
-        instrument_track.emplace_back(delta_ticks, 0, event.message);
-        last_tick = event.tick;
+        return 0;
     }
+    return static_cast<int>(std::round(tempo_us));
+}
 
-    midi_writer.tracks.push_back(instrument_track);
-    return midi_writer;
+static uint32_t time_to_ticks(double time_seconds, int tempo_us,
+                              int tpqn = DEFAULT_TPQN)
+{
+    return static_cast<uint32_t>(
+        std::round((time_seconds * tpqn * 1'000'000) / tempo_us));
 }
 
-std::vector<uint8_t> basic_pitch::convert_to_midi(
-    const basic_pitch::InferenceResult &inference_result,
-    const bool use_melodia_trick,  // defaults to true
-    const bool include_pitch_bends // defaults to false
-)
+static int pitch_bend_value(int pitch_bend)
 {
-    // Process the unwrapped notes and onsets to detect note events
+    int bend_value = pitch_bend * (4096 / CONTOURS_BINS_PER_SEMITONE) + 8192;
+    return std::clamp(bend_value, 0, 16383);
+}
+
+static std::size_t n_midi_events(const basic_pitch::NoteEventList &note_events)
+{
+    // note on and note off, plus the pitch bends
+    std::size_t n_events = 2 * note_events.size();
+    for (std::size_t note_idx = 0; note_idx < note_events.size(); ++note_idx)
+    {
+        if (note_events.has_pitch_bends(note_idx))
+        {
+            n_events += note_events.pitch_bends(note_idx).size();
+        }
+    }
+    return n_events;
+}
+
+std::size_t basic_pitch::detail::note_midi_events(
+    const basic_pitch::NoteEvent &note_event, std::span<const int> pitch_bend,
+    int tempo_us, int pitch_bend_tolerance, uint64_t *out)
+{
+    const int pitch = note_event.pitch;
+    double start_time = basic_pitch::model_frame_to_time(note_event.start_idx);
+    double end_time = basic_pitch::model_frame_to_time(note_event.end_idx);
+    uint32_t start_tick = time_to_ticks(start_time, tempo_us);
+    uint32_t end_tick = time_to_ticks(end_time, tempo_us);
+    int velocity = static_cast<int>(note_event.amplitude * 127);
+    uint64_t *const first = out;
+
+    // Add `Note_on` event at start_tick
+    *out++ = pack_midi_event(start_tick, MidiEventType::NoteOn, pitch,
+                             velocity);
+
+    int num_bends = pitch_bend.size();
+    if (num_bends > 1)
+    {
+        double time_increment = (end_time - start_time) / (num_bends - 1);
+
+        // a bend holds until the next one, so a bend close enough to the
+        // last one written changes the pitch by at most the tolerance and
+        // can be dropped
+        int last_bend = 0;
+        for (int i = 0; i < num_bends; ++i)
+        {
+            if (i > 0 && pitch_bend_tolerance >= 0 &&
+                std::abs(pitch_bend[i] - last_bend) <= pitch_bend_tolerance)
+            {
+                continue;
+            }
+            last_bend = pitch_bend[i];
 
-    std::cout << "output_to_notes_polyphonic" << std::endl;
+            double bend_time = start_time + i * time_increment;
+            uint32_t bend_tick = time_to_ticks(bend_time, tempo_us);
 
-    std::vector<basic_pitch::NoteEvent> note_events =
-        output_to_notes_polyphonic(inference_result, use_melodia_trick,
-                                   include_pitch_bends);
+            // Ensure bend_tick does not exceed end_tick
+            bend_tick = std::min(bend_tick, end_tick);
 
-    if (include_pitch_bends)
+            *out++ =
+                pack_pitch_bend(bend_tick, pitch_bend_value(pitch_bend[i]));
+        }
+    }
+    else if (num_bends == 1)
     {
-        // Drop pitch bends from overlapping notes
-        drop_overlapping_pitch_bends(note_events);
+        // Single pitch bend case, at start_tick
+        *out++ = pack_pitch_bend(start_tick, pitch_bend_value(pitch_bend[0]));
     }
 
-    int n_times_notes = inference_result.notes.dimension(0);
+    // Add `Note_off` event at end_tick
+    *out++ = pack_midi_event(end_tick, MidiEventType::NoteOff, pitch, 0);
 
-    std::cout << "note_events_to_midi" << std::endl;
+    return static_cast<std::size_t>(out - first);
+}
 
-    // Convert the detected note events to a MIDI writer object
-    libremidi::writer midi_writer =
-        note_events_to_midi(note_events, n_times_notes);
+// packed channel events of the notes, sorted by tick and type
+static std::vector<uint64_t>
+note_events_to_midi_events(const basic_pitch::NoteEventList &note_events,
+                           int tempo_us, int pitch_bend_tolerance)
+{
+    // room for every event, fewer are written if the bends are thinned
+    std::vector<uint64_t> midi_events(n_midi_events(note_events));
+    std::size_t n_events = 0;
 
-    std::cout << "done!" << std::endl;
+    // Iterate over note events, with their pitch bends from the arena
+    for (std::size_t note_idx = 0; note_idx < note_events.size(); ++note_idx)
+    {
+        n_events += note_midi_events(
+            note_events[note_idx], note_events.pitch_bends(note_idx), tempo_us,
+            pitch_bend_tolerance, midi_events.data() + n_events);
+    }
+    midi_events.resize(n_events);
 
-    // Use ostringstream to write MIDI data to a byte stream
-    std::ostringstream output(std::ios::binary);
-    midi_writer.write(output);
+    // Sort all events by their absolute tick times, then by message type
+    std::vector<uint64_t> scratch;
+    sort_midi_events(midi_events, scratch);
 
-    // Convert the byte stream to a string
-    std::string midi_string = output.str();
+    return midi_events;
+}
 
-    // Create a vector to hold the MIDI data
-    std::vector<uint8_t> midi_data(midi_string.begin(), midi_string.end());
+std::size_t
+basic_pitch::midi_size_bound(const basic_pitch::NoteEventList &note_events)
+{
+    return smf_size_bound(n_midi_events(note_events));
+}
 
-    // Return the MIDI data as bytes
+std::size_t
+basic_pitch::write_midi(const basic_pitch::NoteEventList &note_events,
+                        const basic_pitch::TranscriptionConfig &config,
+                        uint8_t *out)
+{
+    // the note times only depend on their own frame indices
+    std::vector<uint64_t> midi_events = note_events_to_midi_events(
+        note_events, config.midi_tempo_us, config.pitch_bend_tolerance);
+
+    return write_smf(midi_events, config.midi_tempo_us, config.midi_program,
+                     out);
+}
+
+std::vector<uint8_t>
+basic_pitch::note_events_to_midi(const basic_pitch::NoteEventList &note_events,
+                                 const basic_pitch::TranscriptionConfig &config)
+{
+    // encode into a buffer of the worst-case size, then trim it
+    std::vector<uint8_t> midi_data(midi_size_bound(note_events));
+    midi_data.resize(write_midi(note_events, config, midi_data.data()));
     return midi_data;
 }
+
+// the note tracking stages of convert_to_midi, for dense and sparse
+// posteriorgrams
+template <typename Result>
+static basic_pitch::NoteEventList
+run_note_tracking(const Result &inference_result,
+                  const basic_pitch::TranscriptionConfig &config)
+{
+    // Process the unwrapped notes and onsets to detect note events
+    basic_pitch::NoteEventList note_events =
+        basic_pitch::output_to_notes_polyphonic(inference_result, config);
+
+    if (config.include_pitch_bends)
+    {
+        // Add pitch bends, dropping them from overlapping notes
+        basic_pitch::add_pitch_bends(inference_result.contours, note_events,
+                                     inference_result.pitch_range);
+    }
+
+    return note_events;
+}
+
+template <typename Result>
+static std::vector<uint8_t>
+run_post_processing(const Result &inference_result,
+                    const basic_pitch::TranscriptionConfig &config)
+{
+    basic_pitch::NoteEventList note_events =
+        run_note_tracking(inference_result, config);
+
+    // Convert the detected note events to MIDI bytes
+    return basic_pitch::note_events_to_midi(note_events, config);
+}
+
+template <typename Result>
+static bool
+run_post_processing(const Result &inference_result,
+                    std::span<basic_pitch::NoteSink *const> sinks,
+                    const basic_pitch::TranscriptionConfig &config)
+{
+    basic_pitch::NoteEventList note_events =
+        run_note_tracking(inference_result, config);
+
+    // the sinks take the notes in start order, which the pitch bend stage
+    // already sorted them in
+    if (!config.include_pitch_bends)
+    {
+        note_events.sort();
+    }
+
+    return basic_pitch::write_note_events(note_events, sinks);
+}
+
+template <typename Result>
+static bool run_post_processing(const Result &inference_result, int fd,
+                                const basic_pitch::TranscriptionConfig &config)
+{
+    basic_pitch::MidiStreamWriter writer(fd, config);
+    basic_pitch::NoteSink *sinks[] = {&writer};
+    return run_post_processing(inference_result, sinks, config);
+}
+
+template <typename T>
+std::vector<uint8_t> basic_pitch::convert_to_midi(
+    const basic_pitch::BasicInferenceResult<T> &inference_result,
+    const basic_pitch::TranscriptionConfig &config)
+{
+    return run_post_processing(inference_result, config);
+}
+
+std::vector<uint8_t> basic_pitch::convert_to_midi(
+    const basic_pitch::SparseInferenceResult &inference_result,
+    const basic_pitch::TranscriptionConfig &config)
+{
+    return run_post_processing(inference_result, config);
+}
+
+template <typename T>
+bool basic_pitch::convert_to_midi(
+    const basic_pitch::BasicInferenceResult<T> &inference_result, int fd,
+    const basic_pitch::TranscriptionConfig &config)
+{
+    return run_post_processing(inference_result, fd, config);
+}
+
+bool basic_pitch::convert_to_midi(
+    const basic_pitch::SparseInferenceResult &inference_result, int fd,
+    const basic_pitch::TranscriptionConfig &config)
+{
+    return run_post_processing(inference_result, fd, config);
+}
+
+template <typename T>
+bool basic_pitch::convert_to_notes(
+    const basic_pitch::BasicInferenceResult<T> &inference_result,
+    std::span<basic_pitch::NoteSink *const> sinks,
+    const basic_pitch::TranscriptionConfig &config)
+{
+    return run_post_processing(inference_result, sinks, config);
+}
+
+bool basic_pitch::convert_to_notes(
+    const basic_pitch::SparseInferenceResult &inference_result,
+    std::span<basic_pitch::NoteSink *const> sinks,
+    const basic_pitch::TranscriptionConfig &config)
+{
+    return run_post_processing(inference_result, sinks, config);
+}
+
+// the post-processing is instantiated for the float32 and quantized
+// posteriorgrams
+#define INSTANTIATE_POST_PROCESSING(T)                                        \
+    template basic_pitch::NoteEventList                                        \
+    basic_pitch::output_to_notes_polyphonic<T>(                                \
+        const basic_pitch::BasicInferenceResult<T> &,                          \
+        const basic_pitch::TranscriptionConfig &);                             \
+    template void basic_pitch::add_pitch_bends<T>(                             \
+        const Eigen::Tensor<T, 2> &, basic_pitch::NoteEventList &,             \
+        const basic_pitch::PitchRange &);                                      \
+    template std::vector<uint8_t> basic_pitch::convert_to_midi<T>(             \
+        const basic_pitch::BasicInferenceResult<T> &,                          \
+        const basic_pitch::TranscriptionConfig &);                             \
+    template bool basic_pitch::convert_to_midi<T>(                             \
+        const basic_pitch::BasicInferenceResult<T> &, int,                     \
+        const basic_pitch::TranscriptionConfig &);                             \
+    template bool basic_pitch::convert_to_notes<T>(                            \
+        const basic_pitch::BasicInferenceResult<T> &,                          \
+        std::span<basic_pitch::NoteSink *const>,                               \
+        const basic_pitch::TranscriptionConfig &);
+
+INSTANTIATE_POST_PROCESSING(float)
+INSTANTIATE_POST_PROCESSING(uint16_t)
+INSTANTIATE_POST_PROCESSING(uint8_t)
@@ -0,0 +1,196 @@
+#include "basicpitch.hpp"
+#include "smf_encoder.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+
+using namespace basic_pitch::detail;
+
+namespace
+{
+constexpr std::size_t STREAM_BUFFER_SIZE = 64 * 1024;
+
+// std::push_heap keeps the largest element first, so compare the other way
+// for the earliest (tick, type, order added) first
+bool later_event(const std::pair<uint64_t, uint64_t> &a,
+                 const std::pair<uint64_t, uint64_t> &b)
+{
+    uint64_t key_a = a.first >> MIDI_EVENT_DATA_BITS;
+    uint64_t key_b = b.first >> MIDI_EVENT_DATA_BITS;
+    return key_a != key_b ? key_a > key_b : a.second > b.second;
+}
+
+bool write_all(int fd, const uint8_t *data, std::size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return false;
+        }
+        data += written;
+        size -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+} // namespace
+
+basic_pitch::MidiStreamWriter::MidiStreamWriter(
+    int fd, const TranscriptionConfig &config, int n_tracks)
+    : fd_(fd), config_(config),
+      start_offset_(static_cast<int64_t>(::lseek(fd, 0, SEEK_CUR))),
+      n_tracks_(n_tracks), track_length_offset_(SMF_TRACK_LENGTH_OFFSET),
+      running_status_(SMF_PREFIX_RUNNING_STATUS), buffer_(STREAM_BUFFER_SIZE)
+{
+    buffer_size_ = write_smf_prefix(config_.midi_tempo_us,
+                                    config_.midi_program, n_tracks_,
+                                    buffer_.data()) -
+                   buffer_.data();
+}
+
+bool basic_pitch::MidiStreamWriter::add_note(const NoteEvent &note_event,
+                                             std::span<const int> pitch_bends)
+{
+    if (!ok_)
+    {
+        return false;
+    }
+    if (note_event.start_idx < last_start_idx_)
+    {
+        std::cerr << "Error: notes must be added to the MIDI writer in order "
+                     "of start frame"
+                  << std::endl;
+        ok_ = false;
+        return false;
+    }
+    last_start_idx_ = note_event.start_idx;
+
+    note_events_.resize(2 + pitch_bends.size());
+    std::size_t n_events =
+        note_midi_events(note_event, pitch_bends, config_.midi_tempo_us,
+                         config_.pitch_bend_tolerance, note_events_.data());
+
+    // later notes start at or after this note on, so everything before it
+    // is final
+    if (!write_pending(midi_event_tick(note_events_[0])))
+    {
+        return false;
+    }
+
+    for (std::size_t i = 0; i < n_events; ++i)
+    {
+        pending_.emplace_back(note_events_[i], n_events_added_++);
+        std::push_heap(pending_.begin(), pending_.end(), later_event);
+    }
+    max_pending_events_ = std::max(max_pending_events_, pending_.size());
+    return true;
+}
+
+bool basic_pitch::MidiStreamWriter::finish()
+{
+    // every tick fits in 32 bits
+    if (!ok_ || !write_pending(uint64_t(1) << 32))
+    {
+        return false;
+    }
+
+    uint8_t *end = write_smf_end_of_track(buffer_.data() + buffer_size_);
+    buffer_size_ = end - buffer_.data();
+
+    // the length goes into the buffer if it is still there, as it always
+    // is on an fd that cannot seek
+    uint8_t track_length[4];
+    write_smf_track_length(
+        static_cast<uint32_t>(bytes_written_ + buffer_size_ -
+                              (track_length_offset_ + sizeof(track_length))),
+        track_length);
+    if (track_length_offset_ >= bytes_written_)
+    {
+        std::copy_n(track_length, sizeof(track_length),
+                    buffer_.data() + (track_length_offset_ - bytes_written_));
+    }
+    else if (::pwrite(fd_, track_length, sizeof(track_length),
+                      start_offset_ + track_length_offset_) !=
+             static_cast<ssize_t>(sizeof(track_length)))
+    {
+        std::cerr << "Error: unable to write the MIDI track length"
+                  << std::endl;
+        ok_ = false;
+        return false;
+    }
+
+    if (++track_ < n_tracks_)
+    {
+        // the notes added from here on go to the next track
+        if (buffer_size_ + SMF_TRACK_PREFIX_SIZE + SMF_END_OF_TRACK_SIZE >
+                buffer_.size() &&
+            !flush_buffer())
+        {
+            return false;
+        }
+        track_length_offset_ = bytes_written_ + buffer_size_ + 4;
+        const uint8_t channel = smf_track_channel(track_);
+        end = write_smf_track_prefix(config_.midi_program, channel,
+                                     buffer_.data() + buffer_size_);
+        buffer_size_ = end - buffer_.data();
+        running_status_ = SMF_PREFIX_RUNNING_STATUS | channel;
+        last_tick_ = 0;
+        last_start_idx_ = 0;
+        return true;
+    }
+
+    ok_ = false; // nothing can be added after the end of the file
+    return write_buffer();
+}
+
+bool basic_pitch::MidiStreamWriter::write_pending(uint64_t tick)
+{
+    while (!pending_.empty() &&
+           midi_event_tick(pending_.front().first) < tick)
+    {
+        if (buffer_size_ + SMF_MAX_EVENT_SIZE + SMF_END_OF_TRACK_SIZE >
+                buffer_.size() &&
+            !flush_buffer())
+        {
+            return false;
+        }
+
+        std::pop_heap(pending_.begin(), pending_.end(), later_event);
+        uint8_t *end = write_smf_event(
+            pending_.back().first, smf_track_channel(track_), last_tick_,
+            running_status_, buffer_.data() + buffer_size_);
+        buffer_size_ = end - buffer_.data();
+        pending_.pop_back();
+    }
+    return true;
+}
+
+bool basic_pitch::MidiStreamWriter::flush_buffer()
+{
+    if (start_offset_ < 0)
+    {
+        // nothing can be written to an fd that cannot seek before the track
+        // length is known, so the buffer grows to hold the whole file
+        buffer_.resize(buffer_.size() * 2);
+        return true;
+    }
+    return write_buffer();
+}
+
+bool basic_pitch::MidiStreamWriter::write_buffer()
+{
+    if (!write_all(fd_, buffer_.data(), buffer_size_))
+    {
+        std::cerr << "Error: unable to write MIDI data" << std::endl;
+        ok_ = false;
+        return false;
+    }
+    bytes_written_ += buffer_size_;
+    buffer_size_ = 0;
+    return true;
+}
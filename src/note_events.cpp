@@ -0,0 +1,82 @@
+#include "basicpitch.hpp"
+#include <algorithm>
+#include <vector>
+
+void basic_pitch::NoteEventList::reserve(std::size_t n)
+{
+    start_idx.reserve(n);
+    end_idx.reserve(n);
+    pitch.reserve(n);
+    amplitude.reserve(n);
+    pitch_bend_offset.reserve(n);
+    pitch_bend_length.reserve(n);
+}
+
+void basic_pitch::NoteEventList::clear()
+{
+    start_idx.clear();
+    end_idx.clear();
+    pitch.clear();
+    amplitude.clear();
+    pitch_bend_offset.clear();
+    pitch_bend_length.clear();
+    pitch_bend_arena.clear();
+}
+
+void basic_pitch::NoteEventList::push_back(const NoteEvent &note_event)
+{
+    start_idx.push_back(note_event.start_idx);
+    end_idx.push_back(note_event.end_idx);
+    pitch.push_back(note_event.pitch);
+    amplitude.push_back(note_event.amplitude);
+    pitch_bend_offset.push_back(-1);
+    pitch_bend_length.push_back(0);
+}
+
+int *basic_pitch::NoteEventList::assign_pitch_bends(std::size_t i, int n_bends)
+{
+    int offset = static_cast<int>(pitch_bend_arena.size());
+    pitch_bend_arena.resize(pitch_bend_arena.size() + n_bends);
+
+    pitch_bend_offset[i] = offset;
+    pitch_bend_length[i] = n_bends;
+    return pitch_bend_arena.data() + offset;
+}
+
+void basic_pitch::NoteEventList::sort()
+{
+    // sort the packed keys alone, then gather every column in that order
+    struct SortKey
+    {
+        NoteEvent key;
+        std::size_t index;
+    };
+
+    std::vector<SortKey> keys(size());
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+        keys[i] = {(*this)[i], i};
+    }
+    std::sort(keys.begin(), keys.end(),
+              [](const SortKey &a, const SortKey &b)
+              {
+                  return std::tie(a.key.start_idx, a.key.end_idx, a.key.pitch,
+                                  a.key.amplitude, a.index) <
+                         std::tie(b.key.start_idx, b.key.end_idx, b.key.pitch,
+                                  b.key.amplitude, b.index);
+              });
+
+    std::vector<int> sorted_offset(size());
+    std::vector<int> sorted_length(size());
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+        start_idx[i] = keys[i].key.start_idx;
+        end_idx[i] = keys[i].key.end_idx;
+        pitch[i] = keys[i].key.pitch;
+        amplitude[i] = keys[i].key.amplitude;
+        sorted_offset[i] = pitch_bend_offset[keys[i].index];
+        sorted_length[i] = pitch_bend_length[keys[i].index];
+    }
+    pitch_bend_offset.swap(sorted_offset);
+    pitch_bend_length.swap(sorted_length);
+}
@@ -0,0 +1,230 @@
+#include "basicpitch.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <numeric>
+
+// the arrays are written as they are in memory
+static_assert(std::endian::native == std::endian::little,
+              "the note index is little-endian");
+
+namespace
+{
+constexpr std::array<char, 8> NOTE_INDEX_MAGIC = {'B', 'P', 'N', 'I',
+                                                  'N', 'D', 'E', 'X'};
+
+// frames past this are beyond any transcription and cannot overflow
+constexpr double MAX_QUERY_FRAME = 1 << 30;
+
+// the note times are linear in the frame index
+double seconds_per_frame()
+{
+    return basic_pitch::model_frame_to_time(1) -
+           basic_pitch::model_frame_to_time(0);
+}
+
+template <typename T> void write_array(std::ostream &out, const T &values)
+{
+    out.write(reinterpret_cast<const char *>(values.data()),
+              values.size() * sizeof(values[0]));
+}
+
+template <typename T> bool read_array(std::istream &in, T &values)
+{
+    in.read(reinterpret_cast<char *>(values.data()),
+            values.size() * sizeof(values[0]));
+    return static_cast<bool>(in);
+}
+} // namespace
+
+int basic_pitch::last_frame_at_or_before(double time)
+{
+    // frame 0 is at time 0
+    if (time < 0.0)
+    {
+        return -1;
+    }
+    int frame = static_cast<int>(
+        std::min(std::floor(time / seconds_per_frame()), MAX_QUERY_FRAME));
+    while (basic_pitch::model_frame_to_time(frame) > time)
+    {
+        frame--;
+    }
+    while (frame < MAX_QUERY_FRAME &&
+           basic_pitch::model_frame_to_time(frame + 1) <= time)
+    {
+        frame++;
+    }
+    return frame;
+}
+
+int basic_pitch::first_frame_at_or_after(double time)
+{
+    int frame = last_frame_at_or_before(time);
+    return basic_pitch::model_frame_to_time(frame) < time ? frame + 1 : frame;
+}
+
+basic_pitch::NoteIndex::NoteIndex(const NoteEventList &note_events)
+    : NoteIndex(note_events.start_idx, note_events.end_idx)
+{
+}
+
+basic_pitch::NoteIndex::NoteIndex(std::span<const int> start_idx,
+                                  std::span<const int> end_idx)
+    : note_(start_idx.size())
+{
+    std::iota(note_.begin(), note_.end(), 0u);
+    std::stable_sort(note_.begin(), note_.end(),
+                     [&](uint32_t a, uint32_t b)
+                     {
+                         return std::tie(start_idx[a], end_idx[a]) <
+                                std::tie(start_idx[b], end_idx[b]);
+                     });
+
+    start_.resize(note_.size());
+    end_.resize(note_.size());
+    for (std::size_t i = 0; i < note_.size(); ++i)
+    {
+        start_[i] = start_idx[note_[i]];
+        end_[i] = end_idx[note_[i]];
+    }
+    build();
+}
+
+void basic_pitch::NoteIndex::build()
+{
+    max_end_.resize(note_.size());
+    build_node(0, note_.size());
+}
+
+int basic_pitch::NoteIndex::build_node(std::size_t begin, std::size_t end)
+{
+    if (begin >= end)
+    {
+        return std::numeric_limits<int>::min();
+    }
+    std::size_t mid = begin + (end - begin) / 2;
+    max_end_[mid] = std::max({end_[mid], build_node(begin, mid),
+                              build_node(mid + 1, end)});
+    return max_end_[mid];
+}
+
+void basic_pitch::NoteIndex::query_frames(int first_frame, int last_frame,
+                                          std::vector<uint32_t> &out) const
+{
+    query_node(0, note_.size(), first_frame, last_frame, out);
+}
+
+void basic_pitch::NoteIndex::query_node(std::size_t begin, std::size_t end,
+                                        int first_frame, int last_frame,
+                                        std::vector<uint32_t> &out) const
+{
+    while (begin < end)
+    {
+        std::size_t mid = begin + (end - begin) / 2;
+        // every note below here ends before the range
+        if (max_end_[mid] < first_frame)
+        {
+            return;
+        }
+        query_node(begin, mid, first_frame, last_frame, out);
+
+        // this note and those after it start after the range
+        if (start_[mid] > last_frame)
+        {
+            return;
+        }
+        if (end_[mid] >= first_frame)
+        {
+            out.push_back(note_[mid]);
+        }
+        begin = mid + 1;
+    }
+}
+
+void basic_pitch::NoteIndex::query(double t0, double t1,
+                                   std::vector<uint32_t> &out) const
+{
+    if (t1 < t0)
+    {
+        return;
+    }
+    query_frames(first_frame_at_or_after(t0), last_frame_at_or_before(t1),
+                 out);
+}
+
+bool basic_pitch::NoteIndex::write(std::ostream &out) const
+{
+    const uint32_t n_notes = static_cast<uint32_t>(note_.size());
+    out.write(NOTE_INDEX_MAGIC.data(), NOTE_INDEX_MAGIC.size());
+    out.write(reinterpret_cast<const char *>(&NOTE_INDEX_VERSION),
+              sizeof(NOTE_INDEX_VERSION));
+    out.write(reinterpret_cast<const char *>(&n_notes), sizeof(n_notes));
+    for (std::size_t i = 0; i < note_.size(); ++i)
+    {
+        const std::array<int32_t, 4> record = {
+            start_[i], end_[i], max_end_[i], static_cast<int32_t>(note_[i])};
+        write_array(out, record);
+    }
+    return static_cast<bool>(out);
+}
+
+std::optional<basic_pitch::NoteIndex>
+basic_pitch::NoteIndex::read(std::istream &in)
+{
+    std::array<char, 8> magic{};
+    uint32_t version = 0;
+    uint32_t n_notes = 0;
+    if (!read_array(in, magic) || magic != NOTE_INDEX_MAGIC)
+    {
+        std::cerr << "Error: not a note index" << std::endl;
+        return std::nullopt;
+    }
+    in.read(reinterpret_cast<char *>(&version), sizeof(version));
+    in.read(reinterpret_cast<char *>(&n_notes), sizeof(n_notes));
+    if (!in || version != NOTE_INDEX_VERSION)
+    {
+        std::cerr << "Error: note index version " << version << ", expected "
+                  << NOTE_INDEX_VERSION << std::endl;
+        return std::nullopt;
+    }
+
+    // a seekable stream must hold every record before anything is reserved
+    // for them; others are only read as far as they go
+    constexpr std::size_t RECORD_SIZE = 4 * sizeof(int32_t);
+    const std::istream::pos_type records_begin = in.tellg();
+    if (records_begin != std::istream::pos_type(-1))
+    {
+        in.seekg(0, std::ios::end);
+        const std::streamoff n_bytes = in.tellg() - records_begin;
+        in.seekg(records_begin);
+        if (!in || n_bytes < static_cast<std::streamoff>(n_notes * RECORD_SIZE))
+        {
+            std::cerr << "Error: the note index is truncated" << std::endl;
+            return std::nullopt;
+        }
+    }
+
+    NoteIndex index;
+    for (uint32_t i = 0; i < n_notes; ++i)
+    {
+        std::array<int32_t, 4> record{};
+        if (!read_array(in, record))
+        {
+            std::cerr << "Error: the note index is truncated" << std::endl;
+            return std::nullopt;
+        }
+        // the notes are numbered in the order they were written
+        if (record[3] < 0 || static_cast<uint32_t>(record[3]) >= n_notes)
+        {
+            std::cerr << "Error: the note index refers to note " << record[3]
+                      << " of " << n_notes << std::endl;
+            return std::nullopt;
+        }
+        index.start_.push_back(record[0]);
+        index.end_.push_back(record[1]);
+        index.max_end_.push_back(record[2]);
+        index.note_.push_back(static_cast<uint32_t>(record[3]));
+    }
+    return index;
+}
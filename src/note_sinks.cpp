@@ -0,0 +1,177 @@
+#include "basicpitch.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <iomanip>
+
+// the records are written as they are in memory
+static_assert(std::endian::native == std::endian::little,
+              "the binary note records are little-endian");
+static_assert(sizeof(basic_pitch::NoteRecord) == 20);
+
+namespace
+{
+constexpr std::array<char, 8> NOTE_RECORD_MAGIC = {'B', 'P', 'N', 'O',
+                                                   'T', 'E', 'S', '\0'};
+
+// as in the MIDI note on
+int note_velocity(const basic_pitch::NoteEvent &note_event)
+{
+    return static_cast<int>(note_event.amplitude * 127);
+}
+
+void write_times(std::ostream &out, const basic_pitch::NoteEvent &note_event)
+{
+    out << std::fixed << std::setprecision(6)
+        << basic_pitch::model_frame_to_time(note_event.start_idx) << ','
+        << basic_pitch::model_frame_to_time(note_event.end_idx);
+}
+} // namespace
+
+bool basic_pitch::NoteSink::add_notes(const NoteEventList &note_events)
+{
+    for (std::size_t i = 0; i < note_events.size(); ++i)
+    {
+        if (!add_note(note_events[i], note_events.pitch_bends(i)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool basic_pitch::write_note_events(const NoteEventList &note_events,
+                                    std::span<NoteSink *const> sinks)
+{
+    for (std::size_t i = 0; i < note_events.size(); ++i)
+    {
+        NoteEvent note_event = note_events[i];
+        std::span<const int> pitch_bends = note_events.pitch_bends(i);
+        for (NoteSink *sink : sinks)
+        {
+            if (!sink->add_note(note_event, pitch_bends))
+            {
+                return false;
+            }
+        }
+    }
+
+    bool ok = true;
+    for (NoteSink *sink : sinks)
+    {
+        ok = sink->finish() && ok;
+    }
+    return ok;
+}
+
+basic_pitch::CsvNoteWriter::CsvNoteWriter(std::ostream &out) : out_(out)
+{
+    out_ << "start_time_s,end_time_s,pitch_midi,velocity,pitch_bend\n";
+}
+
+bool basic_pitch::CsvNoteWriter::add_note(const NoteEvent &note_event,
+                                          std::span<const int> pitch_bends)
+{
+    write_times(out_, note_event);
+    out_ << ',' << note_event.pitch << ',' << note_velocity(note_event);
+    for (int bend : pitch_bends)
+    {
+        out_ << ',' << bend;
+    }
+    out_ << '\n';
+    return static_cast<bool>(out_);
+}
+
+bool basic_pitch::CsvNoteWriter::finish()
+{
+    out_.flush();
+    return static_cast<bool>(out_);
+}
+
+basic_pitch::JsonNoteWriter::JsonNoteWriter(std::ostream &out) : out_(out)
+{
+    out_ << '[';
+}
+
+bool basic_pitch::JsonNoteWriter::add_note(const NoteEvent &note_event,
+                                           std::span<const int> pitch_bends)
+{
+    out_ << (n_notes_++ > 0 ? ",\n " : "\n ") << std::fixed
+         << std::setprecision(6) << "{\"start_time_s\": "
+         << model_frame_to_time(note_event.start_idx)
+         << ", \"end_time_s\": " << model_frame_to_time(note_event.end_idx)
+         << ", \"pitch_midi\": " << note_event.pitch
+         << ", \"velocity\": " << note_velocity(note_event)
+         << ", \"pitch_bends\": [";
+    for (std::size_t i = 0; i < pitch_bends.size(); ++i)
+    {
+        out_ << (i > 0 ? ", " : "") << pitch_bends[i];
+    }
+    out_ << "]}";
+    return static_cast<bool>(out_);
+}
+
+bool basic_pitch::JsonNoteWriter::finish()
+{
+    out_ << "\n]\n";
+    out_.flush();
+    return static_cast<bool>(out_);
+}
+
+basic_pitch::BinaryNoteWriter::BinaryNoteWriter(std::ostream &out) : out_(out)
+{
+    out_.write(NOTE_RECORD_MAGIC.data(), NOTE_RECORD_MAGIC.size());
+    out_.write(reinterpret_cast<const char *>(&NOTE_RECORD_VERSION),
+               sizeof(NOTE_RECORD_VERSION));
+}
+
+bool basic_pitch::BinaryNoteWriter::add_note(const NoteEvent &note_event,
+                                             std::span<const int> pitch_bends)
+{
+    NoteRecord record{};
+    record.start_frame = note_event.start_idx;
+    record.end_frame = note_event.end_idx;
+    record.start_time = model_frame_to_time(note_event.start_idx);
+    record.end_time = model_frame_to_time(note_event.end_idx);
+    record.pitch = static_cast<uint8_t>(note_event.pitch);
+    record.velocity = static_cast<uint8_t>(note_velocity(note_event));
+    record.n_pitch_bends = static_cast<uint16_t>(
+        std::min<std::size_t>(pitch_bends.size(), UINT16_MAX));
+
+    // bends are within the pitch bend window of a few semitones, so fit in
+    // a signed byte
+    bends_.resize(record.n_pitch_bends);
+    for (std::size_t i = 0; i < bends_.size(); ++i)
+    {
+        bends_[i] = static_cast<int8_t>(std::clamp(pitch_bends[i], -128, 127));
+    }
+
+    out_.write(reinterpret_cast<const char *>(&record), sizeof(record));
+    out_.write(reinterpret_cast<const char *>(bends_.data()), bends_.size());
+    return static_cast<bool>(out_);
+}
+
+bool basic_pitch::BinaryNoteWriter::finish()
+{
+    out_.flush();
+    return static_cast<bool>(out_);
+}
+
+basic_pitch::NoteIndexWriter::NoteIndexWriter(std::ostream &out) : out_(out)
+{
+}
+
+bool basic_pitch::NoteIndexWriter::add_note(const NoteEvent &note_event,
+                                            std::span<const int>)
+{
+    start_idx_.push_back(note_event.start_idx);
+    end_idx_.push_back(note_event.end_idx);
+    return true;
+}
+
+bool basic_pitch::NoteIndexWriter::finish()
+{
+    bool ok = NoteIndex(start_idx_, end_idx_).write(out_);
+    out_.flush();
+    return ok && static_cast<bool>(out_);
+}
@@ -0,0 +1,250 @@
+#include "basicpitch.hpp"
+#include "pitch_bends.hpp"
+#include <algorithm>
+#include <vector>
+
+using namespace basic_pitch::constants;
+using namespace basic_pitch::detail;
+
+basic_pitch::NoteTracker::NoteTracker(const TranscriptionConfig &config)
+    : config_(config), freq_begin_(config.pitch_range.note_bin_begin()),
+      freq_end_(config.pitch_range.note_bin_end()),
+      prev_onsets_(N_FREQ_BINS_NOTES),
+      last_notes_(N_FREQ_BINS_NOTES), last_onsets_(N_FREQ_BINS_NOTES),
+      last_contours_(N_FREQ_BINS_CONTOURS)
+{
+}
+
+void basic_pitch::NoteTracker::push_frame(const float *notes,
+                                          const float *onsets,
+                                          const float *contours,
+                                          NoteEventList &finished)
+{
+    if (n_frames_ > 0)
+    {
+        // the held-back frame t can now be checked for onset peaks
+        int t = n_frames_ - 1;
+        if (t > 0)
+        {
+            for (int f = freq_end_ - 1; f >= freq_begin_; --f)
+            {
+                if (last_onsets_[f] > config_.onset_threshold &&
+                    last_onsets_[f] > prev_onsets_[f] &&
+                    last_onsets_[f] > onsets[f])
+                {
+                    // a new onset ends the note still open on this pitch
+                    if (open_notes_[f].active)
+                    {
+                        close_note(f, t - open_notes_[f].k, finished);
+                    }
+                    open_note(f, t, true);
+                }
+            }
+        }
+        process_frame(t, finished);
+    }
+
+    std::swap(prev_onsets_, last_onsets_);
+    std::copy(notes, notes + N_FREQ_BINS_NOTES, last_notes_.begin());
+    std::copy(onsets, onsets + N_FREQ_BINS_NOTES, last_onsets_.begin());
+    std::copy(contours, contours + N_FREQ_BINS_CONTOURS,
+              last_contours_.begin());
+    n_frames_++;
+}
+
+void basic_pitch::NoteTracker::flush(NoteEventList &finished)
+{
+    // like the batch path, the final frame is never scanned
+    for (int f = 0; f < N_FREQ_BINS_NOTES; ++f)
+    {
+        if (open_notes_[f].active)
+        {
+            close_note(f, n_frames_ - 1 - open_notes_[f].k, finished);
+        }
+    }
+
+    recent_notes_.clear();
+    n_frames_ = 0;
+}
+
+int basic_pitch::NoteTracker::first_open_frame() const
+{
+    // the held-back frame can still open notes
+    int first = std::max(n_frames_ - 1, 0);
+    for (const OpenNote &note : open_notes_)
+    {
+        if (note.active)
+        {
+            first = std::min(first, note.start_idx);
+        }
+    }
+    return first;
+}
+
+void basic_pitch::NoteTracker::open_note(int freq_idx, int t, bool from_onset)
+{
+    OpenNote &note = open_notes_[freq_idx];
+    note.active = true;
+    note.from_onset = from_onset;
+    note.start_idx = t;
+    note.k = 0;
+    note.amplitude_sum = 0.0f;
+    note.tail_sum = 0.0f;
+    note.pitch_bends.clear();
+}
+
+void basic_pitch::NoteTracker::close_note(int freq_idx, int end_idx,
+                                          NoteEventList &finished)
+{
+    OpenNote &note = open_notes_[freq_idx];
+    note.active = false;
+
+    int start_idx = note.start_idx;
+
+    // Ensure the note is long enough
+    if (end_idx - start_idx <= config_.min_note_len)
+    {
+        return;
+    }
+
+    float amplitude =
+        (note.amplitude_sum - note.tail_sum) / (end_idx - start_idx);
+
+    finished.push_back({start_idx, end_idx, freq_idx + MIDI_OFFSET, amplitude});
+
+    if (config_.include_pitch_bends)
+    {
+        // drop pitch bends if any other note overlaps this one; notes that
+        // are still open started before end_idx and end after start_idx
+        bool overlapping = false;
+        for (int f = 0; f < N_FREQ_BINS_NOTES && !overlapping; ++f)
+        {
+            overlapping = open_notes_[f].active &&
+                          open_notes_[f].start_idx < end_idx;
+        }
+        for (const auto &[other_start, other_end] : recent_notes_)
+        {
+            overlapping = overlapping ||
+                          (other_start < end_idx && start_idx < other_end);
+        }
+
+        if (!overlapping)
+        {
+            int n_bends = end_idx - start_idx;
+            int *pitch_bends =
+                finished.assign_pitch_bends(finished.size() - 1, n_bends);
+            std::copy(note.pitch_bends.begin(),
+                      note.pitch_bends.begin() + n_bends, pitch_bends);
+        }
+
+        recent_notes_.emplace_back(start_idx, end_idx);
+    }
+}
+
+void basic_pitch::NoteTracker::process_frame(int t,
+                                             NoteEventList &finished)
+{
+    // notes are only ever opened within the pitch range
+    for (int f = freq_begin_; f < freq_end_; ++f)
+    {
+        OpenNote &note = open_notes_[f];
+        if (!note.active)
+        {
+            continue;
+        }
+
+        float value = last_notes_[f];
+
+        // the onset (or melodia seed) frame itself is not checked
+        if (t > note.start_idx)
+        {
+            // melodia notes only see energy not claimed by onset notes
+            float energy = value;
+            if (!note.from_onset)
+            {
+                for (int g = std::max(0, f - 1);
+                     g <= std::min(MAX_FREQ_IDX, f + 1); ++g)
+                {
+                    if (open_notes_[g].active && open_notes_[g].from_onset)
+                    {
+                        energy = 0.0f;
+                    }
+                }
+            }
+
+            if (energy < config_.frame_threshold)
+            {
+                note.k++;
+                note.tail_sum += value;
+            }
+            else
+            {
+                note.k = 0;
+                note.tail_sum = 0.0f;
+            }
+        }
+
+        note.amplitude_sum += value;
+        if (config_.include_pitch_bends)
+        {
+            note.pitch_bends.push_back(frame_pitch_bend(
+                last_contours_.data(), PITCH_BEND_WINDOWS[f]));
+        }
+
+        if (note.k == config_.energy_tol)
+        {
+            close_note(f, t + 1 - note.k, finished);
+        }
+    }
+
+    if (config_.use_melodia_trick)
+    {
+        // open notes on unclaimed energy, strongest first so that it wins
+        // over its neighbours
+        std::array<int, N_FREQ_BINS_NOTES> candidates;
+        int n_candidates = 0;
+        for (int f = freq_begin_; f < freq_end_; ++f)
+        {
+            if (!open_notes_[f].active &&
+                last_notes_[f] > config_.frame_threshold)
+            {
+                candidates[n_candidates++] = f;
+            }
+        }
+        std::sort(candidates.begin(), candidates.begin() + n_candidates,
+                  [this](int a, int b)
+                  { return last_notes_[a] > last_notes_[b]; });
+
+        for (int i = 0; i < n_candidates; ++i)
+        {
+            int f = candidates[i];
+            if ((f > 0 && open_notes_[f - 1].active) ||
+                (f < MAX_FREQ_IDX && open_notes_[f + 1].active))
+            {
+                continue;
+            }
+
+            open_note(f, t, false);
+            OpenNote &note = open_notes_[f];
+            note.amplitude_sum = last_notes_[f];
+            if (config_.include_pitch_bends)
+            {
+                note.pitch_bends.push_back(frame_pitch_bend(
+                    last_contours_.data(), PITCH_BEND_WINDOWS[f]));
+            }
+        }
+    }
+
+    // forget emitted notes that end before every note that can still be
+    // emitted
+    int earliest_start = t;
+    for (const auto &note : open_notes_)
+    {
+        if (note.active)
+        {
+            earliest_start = std::min(earliest_start, note.start_idx);
+        }
+    }
+    std::erase_if(recent_notes_, [earliest_start](const auto &interval)
+                  { return interval.second <= earliest_start; });
+}
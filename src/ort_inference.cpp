@@ -8,55 +8,132 @@
 
 using namespace basic_pitch::constants;
 
-static Eigen::Tensor2dXf
-unwrap_output(const Eigen::Tensor3dRowMajorXf &tensor_3d,
-              int audio_original_length, int n_overlapping_frames)
+// Model frames of audio_length samples, which the output is trimmed to
+static int n_audio_frames(int64_t audio_length)
+{
+    return static_cast<int>(
+        std::floor(audio_length *
+                   (ANNOTATIONS_FPS / static_cast<float>(AUDIO_SAMPLE_RATE))));
+}
+
+// Number of frames after unwrapping the overlapping chunks of a row-major
+// (batch, time, freq) output and trimming to the original audio length
+static int
+n_unwrapped_frames(const Eigen::TensorMap<Eigen::Tensor3dRowMajorXf> &tensor_3d,
+                   int audio_original_length, int n_overlapping_frames)
 {
     int batch_size = tensor_3d.dimension(0); // Number of batches (chunks)
     int n_times_short =
-        tensor_3d.dimension(1);           // Number of time steps per chunk
-    int n_freqs = tensor_3d.dimension(2); // Frequency bins
+        tensor_3d.dimension(1); // Number of time steps per chunk
+
+    // Remove overlapping frames from both start and end of each chunk
+    int n_times_kept = n_times_short - 2 * (n_overlapping_frames / 2);
+    int total_time_steps = batch_size * n_times_kept;
 
+    // Calculate the expected output length
+    int n_output_frames_original = n_audio_frames(audio_original_length);
+    return std::min(n_output_frames_original, total_time_steps);
+}
+
+// Unwrap the overlapping chunks of a row-major (batch, time, freq) output
+// into a column-major (time, freq) tensor of T, quantizing each value as it
+// is copied so that no other full-size intermediate is created. Only the
+// bins [freq_begin, freq_end) are kept.
+template <typename T>
+static Eigen::Tensor<T, 2>
+unwrap_output(const Eigen::TensorMap<Eigen::Tensor3dRowMajorXf> &tensor_3d,
+              int audio_original_length, int n_overlapping_frames,
+              int freq_begin, int freq_end)
+{
+    int n_times_short = tensor_3d.dimension(1);
+    int n_freqs = freq_end - freq_begin; // Frequency bins kept
     int n_olap = n_overlapping_frames / 2;
+    int n_times_kept = n_times_short - 2 * n_olap;
 
-    // Remove overlapping frames from both start and end
-    Eigen::array<int, 3> offsets = {0, n_olap, 0};
-    Eigen::array<int, 3> extents = {batch_size, n_times_short - 2 * n_olap,
-                                    n_freqs};
-    Eigen::Tensor<float, 3, Eigen::RowMajor> output_sliced =
-        tensor_3d.slice(offsets, extents);
+    // Trim the output to match the original audio length
+    int n_output_frames = n_unwrapped_frames(tensor_3d, audio_original_length,
+                                             n_overlapping_frames);
+    Eigen::Tensor<T, 2> output(n_output_frames, n_freqs);
+    for (int t = 0; t < n_output_frames; ++t)
+    {
+        int chunk = t / n_times_kept;
+        int chunk_t = n_olap + t % n_times_kept;
+        for (int f = 0; f < n_freqs; ++f)
+        {
+            output(t, f) = basic_pitch::quantize_activation<T>(
+                tensor_3d(chunk, chunk_t, freq_begin + f));
+        }
+    }
+    return output;
+}
 
-    // Flatten the 3D tensor into a 2D tensor
-    int total_time_steps = batch_size * (n_times_short - 2 * n_olap);
-    Eigen::Tensor<float, 2, Eigen::RowMajor> unwrapped_output =
-        output_sliced.reshape(Eigen::array<int, 2>{total_time_steps, n_freqs});
+// Same as unwrap_output, keeping only the cells at or above floor; one bin
+// at a time is gathered into a scratch column
+static basic_pitch::SparseActivations unwrap_output_sparse(
+    const Eigen::TensorMap<Eigen::Tensor3dRowMajorXf> &tensor_3d,
+    int audio_original_length, int n_overlapping_frames, int freq_begin,
+    int freq_end, float floor)
+{
+    int n_times_short = tensor_3d.dimension(1);
+    int n_olap = n_overlapping_frames / 2;
+    int n_times_kept = n_times_short - 2 * n_olap;
 
-    // Calculate the expected output length
-    int n_output_frames_original = static_cast<int>(
-        std::floor(audio_original_length *
-                   (ANNOTATIONS_FPS / static_cast<float>(AUDIO_SAMPLE_RATE))));
-    n_output_frames_original =
-        std::min(n_output_frames_original,
-                 static_cast<int>(unwrapped_output.dimension(0)));
+    int n_output_frames = n_unwrapped_frames(tensor_3d, audio_original_length,
+                                             n_overlapping_frames);
+    basic_pitch::SparseActivations output(n_output_frames, floor);
+    std::vector<float> column(n_output_frames);
+    for (int f = freq_begin; f < freq_end; ++f)
+    {
+        for (int t = 0; t < n_output_frames; ++t)
+        {
+            column[t] =
+                tensor_3d(t / n_times_kept, n_olap + t % n_times_kept, f);
+        }
+        output.append_bin(column.data());
+    }
+    return output;
+}
+
+// Input and output names
+static const char *const MODEL_INPUT_NAMES[] = {"serving_default_input_2:0"};
+static const char *const MODEL_OUTPUT_NAMES[] = {
+    "StatefulPartitionedCall:1", // note
+    "StatefulPartitionedCall:2", // onset
+    "StatefulPartitionedCall:0"  // contour
+};
 
-    // Trim the output tensor to match the original audio length
-    Eigen::Tensor<float, 2, Eigen::RowMajor> final_output =
-        unwrapped_output.slice(
-            Eigen::array<int, 2>{0, 0},
-            Eigen::array<int, 2>{n_output_frames_original, n_freqs});
+// Constants for processing; overlap 30 frames
+constexpr int N_OVERLAPPING_FRAMES = 30;
+constexpr int OVERLAP_LEN = N_OVERLAPPING_FRAMES * FFT_HOP;
+constexpr int WINDOW_HOP_SIZE = AUDIO_N_SAMPLES - OVERLAP_LEN;
+constexpr int WINDOW_SIZE = AUDIO_N_SAMPLES;
+// frames each window keeps between its overlaps
+constexpr int WINDOW_N_FRAMES =
+    static_cast<int>(ANNOT_N_FRAMES) - N_OVERLAPPING_FRAMES;
 
-    // Return the final output as a column-major tensor
-    return final_output.swap_layout().shuffle(Eigen::array<int, 2>{1, 0});
+// First sample of a window in the input; the first window starts half an
+// overlap early, in the zero padding
+static int64_t window_first_sample(int window)
+{
+    return static_cast<int64_t>(window) * WINDOW_HOP_SIZE - OVERLAP_LEN / 2;
 }
 
-basic_pitch::InferenceResult
-basic_pitch::ort_inference(const std::vector<float> &mono_audio)
+// Frames kept of a section whose audio is `length` samples: up to its end
+// frame, or where the whole input would be trimmed if it ended with the
+// section
+static int n_section_frames(const basic_pitch::ModelSection &section,
+                            int64_t length)
 {
-    return ort_inference(mono_audio.data(), mono_audio.size());
+    const int end_frame = std::min(
+        section.end_frame, n_audio_frames(section.first_sample + length));
+    return std::max(0, end_frame - section.frame_offset);
 }
 
-basic_pitch::InferenceResult basic_pitch::ort_inference(const float *mono_audio,
-                                                        int length)
+// Run the model over the chunked audio and pass the row-major (batch, time,
+// freq) note, onset and contour outputs to `unwrap`, which must copy what
+// it needs before the outputs are released
+template <typename Unwrap>
+static auto run_model(const float *mono_audio, int length, Unwrap &&unwrap)
 {
     // Initialize ONNX Runtime environment
     Ort::Env env(ORT_LOGGING_LEVEL_WARNING, "basic_pitch");
@@ -67,11 +144,9 @@ basic_pitch::InferenceResult basic_pitch::ort_inference(const float *mono_audio,
     // Create the ONNX Runtime session from the in-memory ORT model
     Ort::Session session(env, model_ort_start, model_ort_size, session_options);
 
-    // Constants for processing; overlap 30 frames
-    const int chunk_size = AUDIO_N_SAMPLES;
-    int n_overlapping_frames = 30;
-    int overlap_len = n_overlapping_frames * FFT_HOP;
-    int hop_size = AUDIO_N_SAMPLES - overlap_len;
+    const int chunk_size = WINDOW_SIZE;
+    int overlap_len = OVERLAP_LEN;
+    int hop_size = WINDOW_HOP_SIZE;
 
     // Padding the start of the audio (overlap_len / 2 zeros at the start)
     std::vector<float> padded_audio(overlap_len / 2, 0.0f);
@@ -108,17 +183,10 @@ basic_pitch::InferenceResult basic_pitch::ort_inference(const float *mono_audio,
         }
     }
 
-    // Input and output names
-    const char *input_names[] = {"serving_default_input_2:0"};
-    const char *output_names[] = {
-        "StatefulPartitionedCall:1", // note
-        "StatefulPartitionedCall:2", // onset
-        "StatefulPartitionedCall:0"  // contour
-    };
-
     // Run the inference
-    auto output_tensors = session.Run(Ort::RunOptions{nullptr}, input_names,
-                                      &input_tensor, 1, output_names, 3);
+    auto output_tensors =
+        session.Run(Ort::RunOptions{nullptr}, MODEL_INPUT_NAMES, &input_tensor,
+                    1, MODEL_OUTPUT_NAMES, 3);
 
     // Retrieve and process shapes for each output
     std::vector<int64_t> note_shape =
@@ -151,15 +219,497 @@ basic_pitch::InferenceResult basic_pitch::ort_inference(const float *mono_audio,
     Eigen::TensorMap<Eigen::Tensor3dRowMajorXf> contour_tensor(
         contour_data, batch_size, n_times_short_contours, n_freqs_contours);
 
-    // Use unwrap_output to unwrap and convert the row-major 3D tensors to
-    // col-major 2D tensors
-    Eigen::Tensor2dXf unwrapped_notes =
-        unwrap_output(note_tensor, audio_original_length, 30);
-    Eigen::Tensor2dXf unwrapped_onsets =
-        unwrap_output(onset_tensor, audio_original_length, 30);
-    Eigen::Tensor2dXf unwrapped_contours =
-        unwrap_output(contour_tensor, audio_original_length, 30);
+    return unwrap(note_tensor, onset_tensor, contour_tensor,
+                  audio_original_length);
+}
+
+basic_pitch::InferenceResult
+basic_pitch::ort_inference(const std::vector<float> &mono_audio)
+{
+    return ort_inference(mono_audio.data(), mono_audio.size());
+}
+
+basic_pitch::InferenceResult basic_pitch::ort_inference(const float *mono_audio,
+                                                        int length)
+{
+    return ort_inference_as<float>(mono_audio, length);
+}
+
+template <typename T>
+basic_pitch::BasicInferenceResult<T>
+basic_pitch::ort_inference_as(const float *mono_audio, int length,
+                              const PitchRange &pitch_range)
+{
+    const int note_begin = pitch_range.note_bin_begin();
+    const int note_end = pitch_range.note_bin_end();
+    const int contour_begin = pitch_range.contour_bin_begin();
+    const int contour_end = pitch_range.contour_bin_end();
+
+    return run_model(
+        mono_audio, length,
+        [&](const auto &notes, const auto &onsets, const auto &contours,
+            int audio_original_length)
+        {
+            // Use unwrap_output to unwrap and convert the row-major 3D
+            // tensors to col-major 2D tensors
+            return BasicInferenceResult<T>{
+                unwrap_output<T>(notes, audio_original_length,
+                                 N_OVERLAPPING_FRAMES, note_begin, note_end),
+                unwrap_output<T>(onsets, audio_original_length,
+                                 N_OVERLAPPING_FRAMES, note_begin, note_end),
+                unwrap_output<T>(contours, audio_original_length,
+                                 N_OVERLAPPING_FRAMES, contour_begin,
+                                 contour_end),
+                pitch_range};
+        });
+}
+
+basic_pitch::SparseInferenceResult
+basic_pitch::ort_inference_sparse(const float *mono_audio, int length,
+                                  float floor, const PitchRange &pitch_range)
+{
+    const int note_begin = pitch_range.note_bin_begin();
+    const int note_end = pitch_range.note_bin_end();
+    const int contour_begin = pitch_range.contour_bin_begin();
+    const int contour_end = pitch_range.contour_bin_end();
+
+    return run_model(
+        mono_audio, length,
+        [&](const auto &notes, const auto &onsets, const auto &contours,
+            int audio_original_length)
+        {
+            return SparseInferenceResult{
+                unwrap_output_sparse(notes, audio_original_length,
+                                     N_OVERLAPPING_FRAMES, note_begin,
+                                     note_end, floor),
+                unwrap_output_sparse(onsets, audio_original_length,
+                                     N_OVERLAPPING_FRAMES, note_begin,
+                                     note_end, floor),
+                unwrap_output_sparse(contours, audio_original_length,
+                                     N_OVERLAPPING_FRAMES, contour_begin,
+                                     contour_end, floor),
+                pitch_range};
+        });
+}
+
+// The session and its input tensor of one window per channel, made once per
+// stream
+struct basic_pitch::StreamingInference::Model
+{
+    explicit Model(int n_channels) : input_shape{n_channels, WINDOW_SIZE, 1}
+    {
+    }
+
+    Ort::Env env{ORT_LOGGING_LEVEL_WARNING, "basic_pitch"};
+    Ort::SessionOptions session_options;
+    Ort::Session session{env, model_ort_start, model_ort_size,
+                         session_options};
+    Ort::AllocatorWithDefaultOptions allocator;
+    std::array<int64_t, 3> input_shape;
+    Ort::Value input_tensor = Ort::Value::CreateTensor<float>(
+        allocator, input_shape.data(), input_shape.size());
+};
+
+basic_pitch::ModelSection basic_pitch::model_section(int first_frame,
+                                                     int end_frame)
+{
+    ModelSection section;
+    section.first_window = first_frame / WINDOW_N_FRAMES;
+    section.frame_offset = section.first_window * WINDOW_N_FRAMES;
+    section.first_sample =
+        std::max<int64_t>(window_first_sample(section.first_window), 0);
+
+    // A window keeps a little more than a hop's worth of frames, so the
+    // later frames of a long input are only kept once the input runs on
+    // past their window. The section ends with a whole window past which
+    // none of its frames is trimmed; the frames of the next one never are.
+    int last_window = std::max(end_frame - 1, first_frame) / WINDOW_N_FRAMES;
+    while (n_audio_frames(window_first_sample(last_window) + WINDOW_SIZE) <
+           end_frame)
+    {
+        ++last_window;
+    }
+    section.end_frame = (last_window + 1) * WINDOW_N_FRAMES;
+    section.end_sample = window_first_sample(last_window) + WINDOW_SIZE;
+    return section;
+}
+
+basic_pitch::StreamingInference::StreamingInference(int first_window,
+                                                    int n_channels)
+    : model_(std::make_unique<Model>(n_channels)), first_window_(first_window),
+      n_channels_(n_channels), window_audio_(n_channels)
+{
+    reset();
+}
+
+basic_pitch::StreamingInference::~StreamingInference() = default;
+
+void basic_pitch::StreamingInference::push_audio(const float *mono_audio,
+                                                 int length,
+                                                 const FrameCallback &on_frame)
+{
+    push_audio(std::span(&mono_audio, 1), length,
+               [&](int, const float *notes, const float *onsets,
+                   const float *contours)
+               { on_frame(notes, onsets, contours); });
+}
+
+void basic_pitch::StreamingInference::push_audio(
+    std::span<const float *const> channel_audio, int length,
+    const ChannelFrameCallback &on_frame)
+{
+    for (int c = 0; c < n_channels_; ++c)
+    {
+        window_audio_[c].insert(window_audio_[c].end(), channel_audio[c],
+                                channel_audio[c] + length);
+    }
+    n_samples_ += length;
+    while (window_audio_[0].size() >= static_cast<std::size_t>(WINDOW_SIZE))
+    {
+        run_window();
+    }
 
-    return InferenceResult{unwrapped_notes, unwrapped_onsets,
-                           unwrapped_contours};
+    // the frames past the end of the audio so far may still be trimmed
+    emit_frames(std::min(n_frames_computed_, n_audio_frames(n_samples_)),
+                on_frame);
 }
+
+void basic_pitch::StreamingInference::finish(const FrameCallback &on_frame)
+{
+    finish([&](int, const float *notes, const float *onsets,
+               const float *contours)
+           { on_frame(notes, onsets, contours); });
+}
+
+void basic_pitch::StreamingInference::finish(
+    const ChannelFrameCallback &on_frame)
+{
+    // as many windows as ort_inference runs over the padded audio, the last
+    // ones zero-padded
+    const int64_t padded_length = n_samples_ + OVERLAP_LEN / 2;
+    for (int64_t window_start = padded_length - window_audio_[0].size();
+         window_start < padded_length; window_start += WINDOW_HOP_SIZE)
+    {
+        for (std::vector<float> &audio : window_audio_)
+        {
+            audio.resize(std::max<std::size_t>(audio.size(), WINDOW_SIZE),
+                         0.0f);
+        }
+        run_window();
+    }
+    emit_frames(std::min(n_frames_computed_, n_audio_frames(n_samples_)),
+                on_frame);
+    reset();
+}
+
+void basic_pitch::StreamingInference::reset()
+{
+    // only the first window of the input reaches into the zero padding
+    const int64_t first_sample = window_first_sample(first_window_);
+    for (std::vector<float> &audio : window_audio_)
+    {
+        audio.assign(std::max<int64_t>(-first_sample, 0), 0.0f);
+    }
+    n_samples_ = std::max<int64_t>(first_sample, 0);
+    frames_.clear();
+    n_frames_computed_ = first_window_ * WINDOW_N_FRAMES;
+    n_frames_emitted_ = n_frames_computed_;
+}
+
+void basic_pitch::StreamingInference::run_window()
+{
+    // the window of channel c is batch c
+    float *input = model_->input_tensor.GetTensorMutableData<float>();
+    for (int c = 0; c < n_channels_; ++c)
+    {
+        std::copy(window_audio_[c].begin(),
+                  window_audio_[c].begin() + WINDOW_SIZE,
+                  input + c * WINDOW_SIZE);
+    }
+    auto output_tensors = model_->session.Run(
+        Ort::RunOptions{nullptr}, MODEL_INPUT_NAMES, &model_->input_tensor, 1,
+        MODEL_OUTPUT_NAMES, 3);
+
+    // keep the frames between the overlaps, interleaved per frame and
+    // channel
+    const float *notes = output_tensors[0].GetTensorMutableData<float>();
+    const float *onsets = output_tensors[1].GetTensorMutableData<float>();
+    const float *contours = output_tensors[2].GetTensorMutableData<float>();
+    const int n_times_short =
+        output_tensors[0].GetTensorTypeAndShapeInfo().GetShape()[1];
+    const int n_olap = N_OVERLAPPING_FRAMES / 2;
+    const int n_frames_kept = n_times_short - 2 * n_olap;
+    for (int t = n_olap; t < n_olap + n_frames_kept; ++t)
+    {
+        for (int c = 0; c < n_channels_; ++c)
+        {
+            const int ct = c * n_times_short + t;
+            frames_.insert(frames_.end(), notes + ct * N_FREQ_BINS_NOTES,
+                           notes + (ct + 1) * N_FREQ_BINS_NOTES);
+            frames_.insert(frames_.end(), onsets + ct * N_FREQ_BINS_NOTES,
+                           onsets + (ct + 1) * N_FREQ_BINS_NOTES);
+            frames_.insert(frames_.end(), contours + ct * N_FREQ_BINS_CONTOURS,
+                           contours + (ct + 1) * N_FREQ_BINS_CONTOURS);
+        }
+    }
+    n_frames_computed_ += n_frames_kept;
+
+    for (std::vector<float> &audio : window_audio_)
+    {
+        audio.erase(audio.begin(), audio.begin() + WINDOW_HOP_SIZE);
+    }
+}
+
+void basic_pitch::StreamingInference::emit_frames(
+    int n_frames, const ChannelFrameCallback &on_frame)
+{
+    const std::size_t frame_size =
+        2 * N_FREQ_BINS_NOTES + N_FREQ_BINS_CONTOURS;
+    const float *frame = frames_.data();
+    for (; n_frames_emitted_ < n_frames; ++n_frames_emitted_)
+    {
+        for (int c = 0; c < n_channels_; ++c)
+        {
+            on_frame(c, frame, frame + N_FREQ_BINS_NOTES,
+                     frame + 2 * N_FREQ_BINS_NOTES);
+            frame += frame_size;
+        }
+    }
+    frames_.erase(frames_.begin(), frames_.begin() + (frame - frames_.data()));
+}
+
+// samples read from an AudioReader at a time
+constexpr int AUDIO_READ_BLOCK_SIZE = 8192;
+
+// Push the audio of each reader through one StreamingInference from
+// first_window on, as a channel of its own, passing on each frame with its
+// channel and its index from there
+template <typename OnFrame>
+static void run_streaming(std::span<const basic_pitch::AudioReader> read_audio,
+                          int first_window, OnFrame &&on_frame)
+{
+    const int n_channels = static_cast<int>(read_audio.size());
+    std::vector<int> t(n_channels, 0);
+    basic_pitch::StreamingInference::ChannelFrameCallback on_next_frame =
+        [&](int c, const float *notes, const float *onsets,
+            const float *contours)
+    { on_frame(c, t[c]++, notes, onsets, contours); };
+
+    basic_pitch::StreamingInference inference(first_window, n_channels);
+    std::vector<std::vector<float>> blocks(
+        n_channels, std::vector<float>(AUDIO_READ_BLOCK_SIZE));
+    std::vector<const float *> channel_audio;
+    for (const std::vector<float> &block : blocks)
+    {
+        channel_audio.push_back(block.data());
+    }
+    int n_read;
+    while ((n_read = read_audio[0](blocks[0].data(), AUDIO_READ_BLOCK_SIZE)) >
+           0)
+    {
+        // the signals are of the same length; one that ends early is
+        // padded with silence
+        for (int c = 1; c < n_channels; ++c)
+        {
+            const int n = std::max(read_audio[c](blocks[c].data(), n_read), 0);
+            std::fill(blocks[c].begin() + n, blocks[c].begin() + n_read,
+                      0.0f);
+        }
+        inference.push_audio(channel_audio, n_read, on_next_frame);
+    }
+    inference.finish(on_next_frame);
+}
+
+template <typename T>
+basic_pitch::BasicInferenceResult<T>
+basic_pitch::ort_inference_as(const AudioReader &read_audio, int64_t length,
+                              const PitchRange &pitch_range,
+                              const ModelSection &section)
+{
+    return std::move(ort_inference_channels<T>(std::span(&read_audio, 1),
+                                               length, pitch_range, section)
+                         .front());
+}
+
+template <typename T>
+std::vector<basic_pitch::BasicInferenceResult<T>>
+basic_pitch::ort_inference_channels(std::span<const AudioReader> read_audio,
+                                    int64_t length,
+                                    const PitchRange &pitch_range,
+                                    const ModelSection &section)
+{
+    const int note_begin = pitch_range.note_bin_begin();
+    const int n_notes = pitch_range.note_bin_end() - note_begin;
+    const int contour_begin = pitch_range.contour_bin_begin();
+    const int n_contours = pitch_range.contour_bin_end() - contour_begin;
+    const int n_frames = n_section_frames(section, length);
+
+    std::vector<BasicInferenceResult<T>> results;
+    for (std::size_t c = 0; c < read_audio.size(); ++c)
+    {
+        results.push_back({Eigen::Tensor<T, 2>(n_frames, n_notes),
+                           Eigen::Tensor<T, 2>(n_frames, n_notes),
+                           Eigen::Tensor<T, 2>(n_frames, n_contours),
+                           pitch_range});
+        results.back().notes.setZero();
+        results.back().onsets.setZero();
+        results.back().contours.setZero();
+    }
+
+    run_streaming(read_audio, section.first_window,
+                  [&](int c, int t, const float *notes, const float *onsets,
+                      const float *contours)
+                  {
+                      if (t >= n_frames)
+                      {
+                          return;
+                      }
+                      BasicInferenceResult<T> &result = results[c];
+                      for (int f = 0; f < n_notes; ++f)
+                      {
+                          result.notes(t, f) =
+                              quantize_activation<T>(notes[note_begin + f]);
+                          result.onsets(t, f) =
+                              quantize_activation<T>(onsets[note_begin + f]);
+                      }
+                      for (int f = 0; f < n_contours; ++f)
+                      {
+                          result.contours(t, f) = quantize_activation<T>(
+                              contours[contour_begin + f]);
+                      }
+                  });
+    return results;
+}
+
+// Gathers the cells at or above the floor frame by frame, as runs per bin,
+// and lays them out bin after bin at the end
+class SparseRunCollector
+{
+  public:
+    SparseRunCollector(int bin_begin, int bin_end, float floor)
+        : bin_begin_(bin_begin), floor_(floor), bins_(bin_end - bin_begin)
+    {
+    }
+
+    void push_frame(int t, const float *frame)
+    {
+        for (std::size_t b = 0; b < bins_.size(); ++b)
+        {
+            float x = frame[bin_begin_ + b];
+            if (x < floor_)
+            {
+                continue;
+            }
+            Bin &bin = bins_[b];
+            if (bin.run_start.empty() || bin.run_end != t)
+            {
+                bin.run_start.push_back(t);
+                bin.run_values.push_back(static_cast<int>(bin.values.size()));
+            }
+            bin.values.push_back(x);
+            bin.run_end = t + 1;
+        }
+    }
+
+    basic_pitch::SparseActivations finish(int n_frames)
+    {
+        basic_pitch::SparseActivations sparse(n_frames, floor_);
+        for (Bin &bin : bins_)
+        {
+            bin.run_values.push_back(static_cast<int>(bin.values.size()));
+            for (std::size_t r = 0; r < bin.run_start.size(); ++r)
+            {
+                sparse.run_start.push_back(bin.run_start[r]);
+                sparse.values.insert(sparse.values.end(),
+                                     bin.values.begin() + bin.run_values[r],
+                                     bin.values.begin() +
+                                         bin.run_values[r + 1]);
+                sparse.run_values.push_back(
+                    static_cast<int>(sparse.values.size()));
+            }
+            sparse.bin_runs.push_back(
+                static_cast<int>(sparse.run_start.size()));
+            sparse.n_bins++;
+            bin = Bin{};
+        }
+        return sparse;
+    }
+
+  private:
+    struct Bin
+    {
+        std::vector<int> run_start;
+        std::vector<int> run_values; // offset of each run into values
+        std::vector<float> values;
+        int run_end = 0;
+    };
+
+    int bin_begin_;
+    float floor_;
+    std::vector<Bin> bins_;
+};
+
+basic_pitch::SparseInferenceResult
+basic_pitch::ort_inference_sparse(const AudioReader &read_audio,
+                                  int64_t length, float floor,
+                                  const PitchRange &pitch_range,
+                                  const ModelSection &section)
+{
+    const int n_frames = n_section_frames(section, length);
+    SparseRunCollector notes(pitch_range.note_bin_begin(),
+                             pitch_range.note_bin_end(), floor);
+    SparseRunCollector onsets(pitch_range.note_bin_begin(),
+                              pitch_range.note_bin_end(), floor);
+    SparseRunCollector contours(pitch_range.contour_bin_begin(),
+                                pitch_range.contour_bin_end(), floor);
+
+    run_streaming(std::span(&read_audio, 1), section.first_window,
+                  [&](int, int t, const float *note_frame,
+                      const float *onset_frame, const float *contour_frame)
+                  {
+                      if (t < n_frames)
+                      {
+                          notes.push_frame(t, note_frame);
+                          onsets.push_frame(t, onset_frame);
+                          contours.push_frame(t, contour_frame);
+                      }
+                  });
+    return SparseInferenceResult{notes.finish(n_frames),
+                                 onsets.finish(n_frames),
+                                 contours.finish(n_frames), pitch_range};
+}
+
+template basic_pitch::InferenceResult
+basic_pitch::ort_inference_as<float>(const float *, int,
+                                     const PitchRange &);
+template basic_pitch::InferenceResult16
+basic_pitch::ort_inference_as<uint16_t>(const float *, int,
+                                        const PitchRange &);
+template basic_pitch::InferenceResult8
+basic_pitch::ort_inference_as<uint8_t>(const float *, int,
+                                       const PitchRange &);
+
+template basic_pitch::InferenceResult
+basic_pitch::ort_inference_as<float>(const AudioReader &, int64_t,
+                                     const PitchRange &, const ModelSection &);
+template basic_pitch::InferenceResult16
+basic_pitch::ort_inference_as<uint16_t>(const AudioReader &, int64_t,
+                                        const PitchRange &,
+                                        const ModelSection &);
+template basic_pitch::InferenceResult8
+basic_pitch::ort_inference_as<uint8_t>(const AudioReader &, int64_t,
+                                       const PitchRange &,
+                                       const ModelSection &);
+
+template std::vector<basic_pitch::InferenceResult>
+basic_pitch::ort_inference_channels<float>(std::span<const AudioReader>,
+                                           int64_t, const PitchRange &,
+                                           const ModelSection &);
+template std::vector<basic_pitch::InferenceResult16>
+basic_pitch::ort_inference_channels<uint16_t>(std::span<const AudioReader>,
+                                              int64_t, const PitchRange &,
+                                              const ModelSection &);
+template std::vector<basic_pitch::InferenceResult8>
+basic_pitch::ort_inference_channels<uint8_t>(std::span<const AudioReader>,
+                                             int64_t, const PitchRange &,
+                                             const ModelSection &);
@@ -0,0 +1,193 @@
+#ifndef PITCH_BENDS_HPP
+#define PITCH_BENDS_HPP
+
+#include "basicpitch.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// shared between the batch post-processing in midi_notes.cpp and the
+// frame-by-frame NoteTracker
+namespace basic_pitch::detail
+{
+// half-width of the contour window searched around a note's pitch
+constexpr int PITCH_BEND_TOLERANCE_BINS = 25;
+constexpr int PITCH_BEND_WINDOW_LENGTH = PITCH_BEND_TOLERANCE_BINS * 2 + 1;
+
+// exp() for the constexpr tables below, std::exp is not constexpr
+constexpr double constexpr_exp(double x)
+{
+    // exp(x) = exp(x / 2^n)^(2^n), with a Taylor series for the small part
+    int n_squarings = 0;
+    while (x > 0.5 || x < -0.5)
+    {
+        x /= 2.0;
+        n_squarings++;
+    }
+    double term = 1.0;
+    double sum = 1.0;
+    for (int i = 1; i < 20; ++i)
+    {
+        term *= x / i;
+        sum += term;
+    }
+    for (int i = 0; i < n_squarings; ++i)
+    {
+        sum *= sum;
+    }
+    return sum;
+}
+
+// Gaussian window similar to scipy.signal.windows.gaussian, sigma = 5
+constexpr std::array<float, PITCH_BEND_WINDOW_LENGTH>
+make_pitch_bend_gaussian()
+{
+    std::array<float, PITCH_BEND_WINDOW_LENGTH> freq_gaussian{};
+    const float sigma = 5.0f;
+    for (int i = 0; i < PITCH_BEND_WINDOW_LENGTH; ++i)
+    {
+        float x = static_cast<float>(i - PITCH_BEND_TOLERANCE_BINS);
+        freq_gaussian[i] = static_cast<float>(
+            constexpr_exp(-(x * x) / (2 * sigma * sigma)));
+    }
+    return freq_gaussian;
+}
+
+constexpr std::array<float, PITCH_BEND_WINDOW_LENGTH> PITCH_BEND_GAUSSIAN =
+    make_pitch_bend_gaussian();
+
+// The contour bins are 1/3 semitone wide and start at
+// ANNOTATIONS_BASE_FREQUENCY (27.5 Hz, MIDI pitch 21), so the bin
+// 12 * 3 * log2(midi_to_hz(pitch) / 27.5) is exactly 3 * (pitch - 21)
+constexpr int midi_pitch_to_contour_bin(int pitch_midi)
+{
+    return (pitch_midi - constants::MIDI_OFFSET) *
+           constants::CONTOURS_BINS_PER_SEMITONE;
+}
+
+// contour bins and Gaussian taps that are searched for one note pitch
+struct PitchBendWindow
+{
+    int freq_start_idx;
+    int freq_end_idx;
+    int gaussian_start;
+    int gaussian_end;
+    int pb_shift;
+};
+
+constexpr PitchBendWindow pitch_bend_window(int pitch_midi,
+                                            int n_freqs_contours)
+{
+    const int n_bins_tolerance = PITCH_BEND_TOLERANCE_BINS;
+    int freq_idx = midi_pitch_to_contour_bin(pitch_midi);
+
+    PitchBendWindow w{};
+
+    // Ensure frequency indices are within valid bounds
+    w.freq_start_idx = std::max(0, freq_idx - n_bins_tolerance);
+    w.freq_end_idx =
+        std::min(n_freqs_contours, freq_idx + n_bins_tolerance + 1);
+
+    // Adjust Gaussian window bounds to handle boundary conditions
+    w.gaussian_start = std::max(0, n_bins_tolerance - freq_idx);
+    w.gaussian_end =
+        PITCH_BEND_WINDOW_LENGTH -
+        std::max(0, freq_idx - (n_freqs_contours - n_bins_tolerance - 1));
+
+    // the window is clipped to whichever of the two limits is hit first
+    w.freq_end_idx =
+        std::min(w.freq_end_idx,
+                 w.freq_start_idx + (w.gaussian_end - w.gaussian_start));
+
+    // Shift factor for calculating relative bends
+    w.pb_shift = n_bins_tolerance - std::max(0, n_bins_tolerance - freq_idx);
+    return w;
+}
+
+constexpr std::array<PitchBendWindow, constants::N_FREQ_BINS_NOTES>
+make_pitch_bend_windows()
+{
+    std::array<PitchBendWindow, constants::N_FREQ_BINS_NOTES> windows{};
+    for (int f = 0; f < constants::N_FREQ_BINS_NOTES; ++f)
+    {
+        windows[f] = pitch_bend_window(f + constants::MIDI_OFFSET,
+                                       constants::N_FREQ_BINS_CONTOURS);
+    }
+    return windows;
+}
+
+// windows for every piano key over the full 264-bin contour layout
+constexpr std::array<PitchBendWindow, constants::N_FREQ_BINS_NOTES>
+    PITCH_BEND_WINDOWS = make_pitch_bend_windows();
+
+inline const PitchBendWindow &pitch_bend_window(int pitch_midi)
+{
+    return PITCH_BEND_WINDOWS[pitch_midi - constants::MIDI_OFFSET];
+}
+
+// Pitch bend of a single frame: argmax of the Gaussian-weighted contour
+// window, relative to the window center. `contour` holds the contour bins of
+// the frame contiguously.
+inline int frame_pitch_bend(const float *contour, const PitchBendWindow &w)
+{
+    float max_val = -std::numeric_limits<float>::infinity();
+    int max_idx = 0;
+
+    for (int f = w.freq_start_idx, g = w.gaussian_start; f < w.freq_end_idx;
+         ++f, ++g)
+    {
+        float weighted_value = contour[f] * PITCH_BEND_GAUSSIAN[g];
+        if (weighted_value > max_val)
+        {
+            max_val = weighted_value;
+            max_idx = f; // Store the actual frequency bin index
+        }
+    }
+
+    // Normalize the max index relative to the Gaussian window center
+    return (max_idx - w.freq_start_idx) - w.pb_shift;
+}
+
+// Pitch bends of the n_frames consecutive frames of a column-major contour
+// matrix starting at `contours` (bin f of frame t at contours[f * col_stride
+// + t]). Iterating over bins in the outer loop keeps the inner loop a
+// branch-free running max over contiguous frames, which vectorizes; max_val
+// and max_idx are scratch buffers of at least n_frames elements. The
+// contours may be quantized, the argmax does not depend on their scale.
+template <typename T>
+inline void pitch_bends_column_major(const T *contours,
+                                     std::ptrdiff_t col_stride, int n_frames,
+                                     const PitchBendWindow &w,
+                                     float *__restrict max_val,
+                                     int *__restrict max_idx,
+                                     int *__restrict pitch_bends)
+{
+    std::fill(max_val, max_val + n_frames,
+              -std::numeric_limits<float>::infinity());
+    std::fill(max_idx, max_idx + n_frames, 0);
+
+    for (int f = w.freq_start_idx, g = w.gaussian_start; f < w.freq_end_idx;
+         ++f, ++g)
+    {
+        const T *__restrict col = contours + f * col_stride;
+        const float weight = PITCH_BEND_GAUSSIAN[g];
+        for (int t = 0; t < n_frames; ++t)
+        {
+            float weighted_value = static_cast<float>(col[t]) * weight;
+            bool greater = weighted_value > max_val[t];
+            max_val[t] = greater ? weighted_value : max_val[t];
+            max_idx[t] = greater ? f : max_idx[t];
+        }
+    }
+
+    const int shift = w.freq_start_idx + w.pb_shift;
+    for (int t = 0; t < n_frames; ++t)
+    {
+        pitch_bends[t] = max_idx[t] - shift;
+    }
+}
+} // namespace basic_pitch::detail
+
+#endif // PITCH_BENDS_HPP
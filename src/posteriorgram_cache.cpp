@@ -0,0 +1,216 @@
+#include "basicpitch.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+// the arrays are written as they are in memory
+static_assert(std::endian::native == std::endian::little,
+              "the posteriorgram cache is little-endian");
+
+namespace
+{
+constexpr std::array<char, 8> CACHE_MAGIC = {'B', 'P', 'P', 'G',
+                                             'R', 'A', 'M', '\0'};
+constexpr std::size_t CACHE_HEADER_SIZE = 64;
+constexpr std::size_t CACHE_ALIGNMENT = 64;
+
+struct CacheHeader
+{
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t n_frames;
+    uint32_t n_bins_notes;
+    uint32_t n_bins_contours;
+    std::array<char, CACHE_HEADER_SIZE - 24> reserved;
+};
+static_assert(sizeof(CacheHeader) == CACHE_HEADER_SIZE);
+
+std::size_t aligned(std::size_t offset)
+{
+    return (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+}
+
+void write_padding(std::ofstream &out)
+{
+    static const std::array<char, CACHE_ALIGNMENT> zeros{};
+    std::size_t pos = static_cast<std::size_t>(out.tellp());
+    out.write(zeros.data(), aligned(pos) - pos);
+}
+
+void write_tensor(std::ofstream &out, const Eigen::Tensor2dXf &tensor)
+{
+    write_padding(out);
+    out.write(reinterpret_cast<const char *>(tensor.data()),
+              tensor.size() * sizeof(float));
+}
+
+bool read_tensor(std::ifstream &in, Eigen::Tensor2dXf &tensor)
+{
+    std::size_t pos = static_cast<std::size_t>(in.tellg());
+    in.seekg(aligned(pos));
+    in.read(reinterpret_cast<char *>(tensor.data()),
+            tensor.size() * sizeof(float));
+    return static_cast<bool>(in);
+}
+
+bool write_npy(const std::string &path, const Eigen::Tensor2dXf &tensor)
+{
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+    {
+        std::cerr << "Error: Unable to write " << path << std::endl;
+        return false;
+    }
+
+    // column-major data is a Fortran-ordered (frames, bins) array
+    std::ostringstream dict;
+    dict << "{'descr': '<f4', 'fortran_order': True, 'shape': ("
+         << tensor.dimension(0) << ", " << tensor.dimension(1) << "), }";
+    std::string header = dict.str();
+
+    // pad with spaces and a newline so the data is 64-byte aligned
+    const std::size_t preamble = 10; // magic, version, header length
+    std::size_t total = aligned(preamble + header.size() + 1);
+    header.append(total - preamble - header.size() - 1, ' ');
+    header.push_back('\n');
+
+    const char magic[] = {'\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0};
+    uint16_t header_len = static_cast<uint16_t>(header.size());
+    out.write(magic, sizeof(magic));
+    out.write(reinterpret_cast<const char *>(&header_len), sizeof(header_len));
+    out.write(header.data(), header.size());
+    out.write(reinterpret_cast<const char *>(tensor.data()),
+              tensor.size() * sizeof(float));
+    return static_cast<bool>(out);
+}
+} // namespace
+
+bool basic_pitch::save_posteriorgram(const std::string &path,
+                                     const InferenceResult &inference_result)
+{
+    if (!inference_result.pitch_range.is_full())
+    {
+        std::cerr << "Error: only full-range posteriorgrams can be cached"
+                  << std::endl;
+        return false;
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+    {
+        std::cerr << "Error: Unable to write " << path << std::endl;
+        return false;
+    }
+
+    CacheHeader header{};
+    header.magic = CACHE_MAGIC;
+    header.version = POSTERIORGRAM_CACHE_VERSION;
+    header.n_frames = inference_result.notes.dimension(0);
+    header.n_bins_notes = inference_result.notes.dimension(1);
+    header.n_bins_contours = inference_result.contours.dimension(1);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    write_tensor(out, inference_result.notes);
+    write_tensor(out, inference_result.onsets);
+    write_tensor(out, inference_result.contours);
+    return static_cast<bool>(out);
+}
+
+std::optional<basic_pitch::InferenceResult>
+basic_pitch::load_posteriorgram(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "Error: Unable to read " << path << std::endl;
+        return std::nullopt;
+    }
+
+    CacheHeader header{};
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!in || header.magic != CACHE_MAGIC)
+    {
+        std::cerr << "Error: " << path << " is not a posteriorgram cache"
+                  << std::endl;
+        return std::nullopt;
+    }
+    if (header.version != POSTERIORGRAM_CACHE_VERSION)
+    {
+        std::cerr << "Error: " << path << " has cache version "
+                  << header.version << ", expected "
+                  << POSTERIORGRAM_CACHE_VERSION << std::endl;
+        return std::nullopt;
+    }
+
+    // the header is checked against the file before anything is allocated
+    // for it: full-range bins, and exactly the bytes of its arrays
+    in.seekg(0, std::ios::end);
+    const uint64_t file_size = static_cast<uint64_t>(in.tellg());
+    const uint64_t n_frames = header.n_frames;
+    const uint64_t notes_size =
+        n_frames * constants::N_FREQ_BINS_NOTES * sizeof(float);
+    const uint64_t contours_size =
+        n_frames * constants::N_FREQ_BINS_CONTOURS * sizeof(float);
+    const uint64_t expected_size =
+        aligned(aligned(aligned(sizeof(header)) + notes_size) + notes_size) +
+        contours_size;
+    if (header.n_bins_notes != constants::N_FREQ_BINS_NOTES ||
+        header.n_bins_contours != constants::N_FREQ_BINS_CONTOURS ||
+        header.n_frames == 0 || file_size != expected_size)
+    {
+        std::cerr << "Error: " << path << " is not a valid posteriorgram cache"
+                  << std::endl;
+        return std::nullopt;
+    }
+    in.seekg(sizeof(header));
+
+    // read straight into the tensors, without a staging buffer
+    InferenceResult result{
+        Eigen::Tensor2dXf(header.n_frames, header.n_bins_notes),
+        Eigen::Tensor2dXf(header.n_frames, header.n_bins_notes),
+        Eigen::Tensor2dXf(header.n_frames, header.n_bins_contours),
+        PitchRange{}};
+
+    if (!read_tensor(in, result.notes) || !read_tensor(in, result.onsets) ||
+        !read_tensor(in, result.contours))
+    {
+        std::cerr << "Error: " << path << " is truncated" << std::endl;
+        return std::nullopt;
+    }
+    return result;
+}
+
+bool basic_pitch::save_posteriorgram_npy(
+    const std::string &path_prefix, const InferenceResult &inference_result)
+{
+    return write_npy(path_prefix + ".notes.npy", inference_result.notes) &&
+           write_npy(path_prefix + ".onsets.npy", inference_result.onsets) &&
+           write_npy(path_prefix + ".contours.npy", inference_result.contours);
+}
+
+template <typename T>
+basic_pitch::BasicInferenceResult<T>
+basic_pitch::quantize_posteriorgram(const InferenceResult &inference_result)
+{
+    auto quantize = [](const Eigen::Tensor2dXf &tensor)
+    {
+        Eigen::Tensor<T, 2> quantized(tensor.dimension(0), tensor.dimension(1));
+        std::transform(tensor.data(), tensor.data() + tensor.size(),
+                       quantized.data(), quantize_activation<T>);
+        return quantized;
+    };
+    return BasicInferenceResult<T>{quantize(inference_result.notes),
+                                   quantize(inference_result.onsets),
+                                   quantize(inference_result.contours),
+                                   inference_result.pitch_range};
+}
+
+template basic_pitch::InferenceResult
+basic_pitch::quantize_posteriorgram<float>(const InferenceResult &);
+template basic_pitch::InferenceResult16
+basic_pitch::quantize_posteriorgram<uint16_t>(const InferenceResult &);
+template basic_pitch::InferenceResult8
+basic_pitch::quantize_posteriorgram<uint8_t>(const InferenceResult &);
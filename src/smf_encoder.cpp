@@ -0,0 +1,216 @@
+#include "basicpitch.hpp"
+#include "smf_encoder.hpp"
+#include <array>
+#include <cassert>
+#include <cstring>
+
+using namespace basic_pitch::constants;
+using namespace basic_pitch::detail;
+
+namespace
+{
+// "MTrk" + length
+constexpr std::size_t TRACK_HEADER_SIZE = 8;
+
+uint8_t *write_u16(uint8_t *out, uint16_t value)
+{
+    out[0] = static_cast<uint8_t>(value >> 8);
+    out[1] = static_cast<uint8_t>(value);
+    return out + 2;
+}
+
+uint8_t *write_u32(uint8_t *out, uint32_t value)
+{
+    out[0] = static_cast<uint8_t>(value >> 24);
+    out[1] = static_cast<uint8_t>(value >> 16);
+    out[2] = static_cast<uint8_t>(value >> 8);
+    out[3] = static_cast<uint8_t>(value);
+    return out + 4;
+}
+
+// variable-length quantity, 7 bits per byte, most significant first
+uint8_t *write_vlq(uint8_t *out, uint32_t value)
+{
+    uint8_t buffer[5];
+    int n = 0;
+    do
+    {
+        buffer[n++] = value & 0x7F;
+        value >>= 7;
+    } while (value > 0);
+
+    while (n > 1)
+    {
+        *out++ = buffer[--n] | 0x80;
+    }
+    *out++ = buffer[0];
+    return out;
+}
+
+// write "MTrk" and leave the length to be written after the data
+uint8_t *begin_track(uint8_t *out)
+{
+    std::memcpy(out, "MTrk", 4);
+    return out + TRACK_HEADER_SIZE;
+}
+} // namespace
+
+void basic_pitch::detail::sort_midi_events(std::vector<uint64_t> &events,
+                                           std::vector<uint64_t> &scratch)
+{
+    scratch.resize(events.size());
+
+    // the key is everything above the data bytes
+    uint64_t key_bits = 0;
+    uint64_t first_key = events.empty() ? 0 : events[0] >> MIDI_EVENT_DATA_BITS;
+    for (uint64_t event : events)
+    {
+        key_bits |= (event >> MIDI_EVENT_DATA_BITS) ^ first_key;
+    }
+
+    for (int shift = 0; (key_bits >> shift) != 0; shift += 8)
+    {
+        // a byte that is the same in every key does not need a pass
+        if (((key_bits >> shift) & 0xFF) == 0)
+        {
+            continue;
+        }
+
+        const int bit = MIDI_EVENT_DATA_BITS + shift;
+        std::array<std::size_t, 257> offsets{};
+        for (uint64_t event : events)
+        {
+            offsets[((event >> bit) & 0xFF) + 1]++;
+        }
+        for (int i = 0; i < 256; ++i)
+        {
+            offsets[i + 1] += offsets[i];
+        }
+        for (uint64_t event : events)
+        {
+            scratch[offsets[(event >> bit) & 0xFF]++] = event;
+        }
+        events.swap(scratch);
+    }
+}
+
+std::size_t basic_pitch::detail::smf_size_bound(std::size_t n_events)
+{
+    return SMF_PREFIX_SIZE + n_events * SMF_MAX_EVENT_SIZE +
+           SMF_END_OF_TRACK_SIZE;
+}
+
+uint8_t *basic_pitch::detail::write_smf_prefix(int tempo_us, int midi_program,
+                                               int n_tracks, uint8_t *out)
+{
+    assert(tempo_us >= 1 && tempo_us <= MAX_MIDI_TEMPO_US);
+
+    // header: format 1, the meta track and the instrument tracks
+    std::memcpy(out, "MThd", 4);
+    out = write_u32(out + 4, 6);
+    out = write_u16(out, 1);
+    out = write_u16(out, static_cast<uint16_t>(n_tracks + 1));
+    out = write_u16(out, DEFAULT_TPQN);
+
+    // Track with tempo and time signature
+    uint8_t *track = out;
+    out = begin_track(out);
+    const uint8_t tempo[] = {0x00,
+                             0xFF,
+                             0x51,
+                             0x03,
+                             static_cast<uint8_t>(tempo_us >> 16),
+                             static_cast<uint8_t>(tempo_us >> 8),
+                             static_cast<uint8_t>(tempo_us)};
+    std::memcpy(out, tempo, sizeof(tempo));
+    out += sizeof(tempo);
+
+    // the denominator is written as a power of two; 24 MIDI clocks per
+    // metronome click and 8 32nd notes per quarter note
+    uint8_t denominator_log2 = 0;
+    while ((1 << denominator_log2) < TIME_SIGNATURE_DENOMINATOR)
+    {
+        denominator_log2++;
+    }
+    const uint8_t time_signature[] = {
+        0x00, 0xFF, 0x58, 0x04, TIME_SIGNATURE_NUMERATOR, denominator_log2,
+        24,   8};
+    std::memcpy(out, time_signature, sizeof(time_signature));
+    out += sizeof(time_signature);
+    out = write_smf_end_of_track(out);
+    write_smf_track_length(
+        static_cast<uint32_t>(out - track - TRACK_HEADER_SIZE), track + 4);
+
+    return write_smf_track_prefix(midi_program, smf_track_channel(0), out);
+}
+
+uint8_t *basic_pitch::detail::write_smf_track_prefix(int midi_program,
+                                                     uint8_t midi_channel,
+                                                     uint8_t *out)
+{
+    assert(midi_program >= 0 && midi_program < 128);
+
+    // Instrument track, its length is written once the events are
+    out = begin_track(out);
+    *out++ = 0x00;
+    *out++ = SMF_PREFIX_RUNNING_STATUS | midi_channel;
+    *out++ = static_cast<uint8_t>(midi_program);
+    return out;
+}
+
+uint8_t *basic_pitch::detail::write_smf_event(uint64_t event,
+                                              uint8_t midi_channel,
+                                              uint32_t &last_tick,
+                                              uint8_t &running_status,
+                                              uint8_t *out)
+{
+    uint32_t tick = midi_event_tick(event);
+    out = write_vlq(out, tick - last_tick);
+    last_tick = tick;
+
+    // running status: the status byte is only written when it changes
+    uint8_t status = midi_event_status(midi_event_type(event)) | midi_channel;
+    if (status != running_status)
+    {
+        *out++ = status;
+        running_status = status;
+    }
+    *out++ = static_cast<uint8_t>(event >> 8);
+    *out++ = static_cast<uint8_t>(event);
+    return out;
+}
+
+uint8_t *basic_pitch::detail::write_smf_end_of_track(uint8_t *out)
+{
+    const uint8_t end_of_track[SMF_END_OF_TRACK_SIZE] = {0x00, 0xFF, 0x2F,
+                                                         0x00};
+    std::memcpy(out, end_of_track, SMF_END_OF_TRACK_SIZE);
+    return out + SMF_END_OF_TRACK_SIZE;
+}
+
+void basic_pitch::detail::write_smf_track_length(uint32_t length, uint8_t *out)
+{
+    write_u32(out, length);
+}
+
+std::size_t basic_pitch::detail::write_smf(std::span<const uint64_t> events,
+                                           int tempo_us, int midi_program,
+                                           uint8_t *out)
+{
+    uint8_t *const start = out;
+    out = write_smf_prefix(tempo_us, midi_program, 1, out);
+
+    uint32_t last_tick = 0;
+    uint8_t running_status = SMF_PREFIX_RUNNING_STATUS;
+    for (uint64_t event : events)
+    {
+        out = write_smf_event(event, smf_track_channel(0), last_tick,
+                              running_status, out);
+    }
+    out = write_smf_end_of_track(out);
+    write_smf_track_length(
+        static_cast<uint32_t>(out - start - SMF_TRACK_DATA_OFFSET),
+        start + SMF_TRACK_LENGTH_OFFSET);
+
+    return static_cast<std::size_t>(out - start);
+}
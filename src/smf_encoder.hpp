@@ -0,0 +1,135 @@
+#ifndef SMF_ENCODER_HPP
+#define SMF_ENCODER_HPP
+
+#include "basicpitch.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Standard MIDI File encoding of the note and pitch bend events produced by
+// the post-processing, without going through a general-purpose MIDI library
+namespace basic_pitch::detail
+{
+// in the order events of the same tick are written
+enum class MidiEventType : uint8_t
+{
+    NoteOff = 0,
+    NoteOn = 1,
+    PitchBend = 2,
+};
+
+// A channel event packed into 64 bits: tick, type, then the two data
+// bytes. Ordering packed events by their value above the data bytes orders
+// them by tick, then by type.
+constexpr int MIDI_EVENT_DATA_BITS = 16;
+constexpr int MIDI_EVENT_TYPE_BITS = 2;
+constexpr int MIDI_EVENT_TICK_SHIFT =
+    MIDI_EVENT_DATA_BITS + MIDI_EVENT_TYPE_BITS;
+
+constexpr uint64_t pack_midi_event(uint32_t tick, MidiEventType type,
+                                   uint8_t data1, uint8_t data2)
+{
+    return (static_cast<uint64_t>(tick) << MIDI_EVENT_TICK_SHIFT) |
+           (static_cast<uint64_t>(type) << MIDI_EVENT_DATA_BITS) |
+           (static_cast<uint64_t>(data1) << 8) | data2;
+}
+
+constexpr uint32_t midi_event_tick(uint64_t event)
+{
+    return static_cast<uint32_t>(event >> MIDI_EVENT_TICK_SHIFT);
+}
+
+constexpr MidiEventType midi_event_type(uint64_t event)
+{
+    return static_cast<MidiEventType>((event >> MIDI_EVENT_DATA_BITS) & 0x3);
+}
+
+// status byte on channel 0
+constexpr uint8_t midi_event_status(MidiEventType type)
+{
+    switch (type)
+    {
+    case MidiEventType::NoteOff:
+        return 0x80;
+    case MidiEventType::NoteOn:
+        return 0x90;
+    default:
+        return 0xE0;
+    }
+}
+
+constexpr uint64_t pack_pitch_bend(uint32_t tick, int bend_value)
+{
+    // 14-bit value, least significant 7 bits first
+    return pack_midi_event(tick, MidiEventType::PitchBend, bend_value & 0x7F,
+                           (bend_value >> 7) & 0x7F);
+}
+
+// The channel events of one note, in the order they are added for equal
+// ticks and types: note on, the pitch bends left after thinning with
+// pitch_bend_tolerance, note off. `out` must hold 2 + pitch_bends.size()
+// events; returns the number written.
+std::size_t note_midi_events(const NoteEvent &note_event,
+                             std::span<const int> pitch_bends, int tempo_us,
+                             int pitch_bend_tolerance, uint64_t *out);
+
+// Stable LSD radix sort of packed events by (tick, type), one pass per byte
+// of the key that is not the same in all events; scratch is resized to the
+// number of events
+void sort_midi_events(std::vector<uint64_t> &events,
+                      std::vector<uint64_t> &scratch);
+
+// The file is a format 1 file with a tempo/time signature track and one or
+// more instrument tracks of channel events, using running status. Its
+// prefix is everything before the first channel event: the header, the
+// meta track and the start of the first instrument track up to its program
+// change.
+constexpr std::size_t SMF_PREFIX_SIZE = 52;
+// offset of the first instrument track length in the prefix, and of its
+// data
+constexpr std::size_t SMF_TRACK_LENGTH_OFFSET = 45;
+constexpr std::size_t SMF_TRACK_DATA_OFFSET = 49;
+// the start of each further instrument track, up to its program change;
+// its length is 4 bytes in
+constexpr std::size_t SMF_TRACK_PREFIX_SIZE = 11;
+// a 32-bit delta takes at most 5 bytes, plus status and two data bytes
+constexpr std::size_t SMF_MAX_EVENT_SIZE = 8;
+constexpr std::size_t SMF_END_OF_TRACK_SIZE = 4;
+
+// the running status after the prefix, that of the program change
+constexpr uint8_t SMF_PREFIX_RUNNING_STATUS = 0xC0;
+
+// MIDI channel of instrument track `track`, skipping channel 10 (index 9)
+constexpr uint8_t smf_track_channel(int track)
+{
+    return static_cast<uint8_t>(track < 9 ? track : track + 1);
+}
+
+// Each returns the end of what it wrote. write_smf_prefix starts the file
+// of n_tracks instrument tracks with the first of them, and
+// write_smf_track_prefix each further one. write_smf_event writes the
+// delta from last_tick and the status on midi_channel if it differs from
+// running_status, then updates both.
+uint8_t *write_smf_prefix(int tempo_us, int midi_program, int n_tracks,
+                          uint8_t *out);
+uint8_t *write_smf_track_prefix(int midi_program, uint8_t midi_channel,
+                                uint8_t *out);
+uint8_t *write_smf_event(uint64_t event, uint8_t midi_channel,
+                         uint32_t &last_tick, uint8_t &running_status,
+                         uint8_t *out);
+uint8_t *write_smf_end_of_track(uint8_t *out);
+
+// the big-endian length of an instrument track, 4 bytes into the track
+void write_smf_track_length(uint32_t length, uint8_t *out);
+
+// bytes needed to encode n_events channel events with write_smf
+std::size_t smf_size_bound(std::size_t n_events);
+
+// Write the whole file of the sorted events; `out` must hold
+// smf_size_bound(events.size()) bytes; returns the bytes written.
+std::size_t write_smf(std::span<const uint64_t> events, int tempo_us,
+                      int midi_program, uint8_t *out);
+} // namespace basic_pitch::detail
+
+#endif // SMF_ENCODER_HPP
@@ -0,0 +1,104 @@
+#include "basicpitch.hpp"
+#include <algorithm>
+#include <vector>
+
+basic_pitch::SparseActivations::SparseActivations(int n_frames, float floor)
+    : n_frames(n_frames), floor(floor)
+{
+}
+
+void basic_pitch::SparseActivations::append_bin(const float *column)
+{
+    int t = 0;
+    while (t < n_frames)
+    {
+        // skip to the next cell above the floor
+        while (t < n_frames && column[t] < floor)
+        {
+            t++;
+        }
+        if (t == n_frames)
+        {
+            break;
+        }
+
+        run_start.push_back(t);
+        while (t < n_frames && column[t] >= floor)
+        {
+            values.push_back(column[t]);
+            t++;
+        }
+        run_values.push_back(static_cast<int>(values.size()));
+    }
+    bin_runs.push_back(static_cast<int>(run_start.size()));
+    n_bins++;
+}
+
+int basic_pitch::SparseActivations::find(int t, int bin) const
+{
+    // last run of the bin starting at or before t
+    auto first = run_start.begin() + bin_runs[bin];
+    auto last = run_start.begin() + bin_runs[bin + 1];
+    auto it = std::upper_bound(first, last, t);
+    if (it == first)
+    {
+        return -1;
+    }
+
+    int r = static_cast<int>(it - run_start.begin()) - 1;
+    int offset = t - run_start[r];
+    return offset < run_length(r) ? run_values[r] + offset : -1;
+}
+
+void basic_pitch::SparseActivations::copy_bin(int bin, int t_begin, int t_end,
+                                              float *out) const
+{
+    auto first = run_start.begin() + bin_runs[bin];
+    auto last = run_start.begin() + bin_runs[bin + 1];
+
+    // start from the run that may contain t_begin
+    auto it = std::upper_bound(first, last, t_begin);
+    if (it != first)
+    {
+        --it;
+    }
+
+    for (; it != last && *it < t_end; ++it)
+    {
+        int r = static_cast<int>(it - run_start.begin());
+        int begin = std::max(t_begin, *it);
+        int end = std::min(t_end, *it + run_length(r));
+        for (int t = begin; t < end; ++t)
+        {
+            out[t - t_begin] = values[run_values[r] + t - *it];
+        }
+    }
+}
+
+std::size_t basic_pitch::SparseActivations::memory_bytes() const
+{
+    return (bin_runs.size() + run_start.size() + run_values.size()) *
+               sizeof(int) +
+           values.size() * sizeof(float);
+}
+
+basic_pitch::SparseInferenceResult
+basic_pitch::sparsify_posteriorgram(const InferenceResult &inference_result,
+                                    float floor)
+{
+    // the dense tensors are column-major, so each bin is contiguous
+    auto sparsify = [floor](const Eigen::Tensor2dXf &tensor)
+    {
+        int n_frames = tensor.dimension(0);
+        SparseActivations sparse(n_frames, floor);
+        for (int f = 0; f < tensor.dimension(1); ++f)
+        {
+            sparse.append_bin(tensor.data() + f * n_frames);
+        }
+        return sparse;
+    };
+    return SparseInferenceResult{sparsify(inference_result.notes),
+                                 sparsify(inference_result.onsets),
+                                 sparsify(inference_result.contours),
+                                 inference_result.pitch_range};
+}
@@ -0,0 +1,111 @@
+#include "basicpitch.hpp"
+#include <algorithm>
+
+namespace
+{
+// append note i of `from` to `to`, with its pitch bends
+void append_note(const basic_pitch::NoteEventList &from, std::size_t i,
+                 basic_pitch::NoteEventList &to)
+{
+    to.push_back(from[i]);
+    if (from.has_pitch_bends(i))
+    {
+        std::span<const int> pitch_bends = from.pitch_bends(i);
+        std::copy(pitch_bends.begin(), pitch_bends.end(),
+                  to.assign_pitch_bends(to.size() - 1,
+                                        static_cast<int>(pitch_bends.size())));
+    }
+}
+} // namespace
+
+basic_pitch::StreamingTranscriber::StreamingTranscriber(
+    std::span<NoteSink *const> sinks, const TranscriptionConfig &config)
+    : sinks_(sinks.begin(), sinks.end()), tracker_(config)
+{
+}
+
+bool basic_pitch::StreamingTranscriber::push_audio(const float *mono_audio,
+                                                   int length)
+{
+    if (!ok_)
+    {
+        return false;
+    }
+    inference_.push_audio(mono_audio, length,
+                          [this](const float *notes, const float *onsets,
+                                 const float *contours)
+                          { push_frame(notes, onsets, contours); });
+
+    // later notes start at or after the first open frame
+    return emit_notes(tracker_.first_open_frame());
+}
+
+bool basic_pitch::StreamingTranscriber::finish()
+{
+    inference_.finish([this](const float *notes, const float *onsets,
+                             const float *contours)
+                      { push_frame(notes, onsets, contours); });
+    tracker_.flush(finished_);
+
+    bool ok = ok_ && emit_notes(std::numeric_limits<int>::max());
+    for (NoteSink *sink : sinks_)
+    {
+        ok = ok && sink->finish();
+    }
+
+    finished_.clear();
+    pending_.clear();
+    ok_ = true;
+    return ok;
+}
+
+void basic_pitch::StreamingTranscriber::push_frame(const float *notes,
+                                                   const float *onsets,
+                                                   const float *contours)
+{
+    tracker_.push_frame(notes, onsets, contours, finished_);
+    n_frames_++;
+}
+
+bool basic_pitch::StreamingTranscriber::emit_notes(int end_frame)
+{
+    if (finished_.empty() && (pending_.empty() ||
+                              pending_.start_idx.front() >= end_frame))
+    {
+        return ok_;
+    }
+
+    for (std::size_t i = 0; i < finished_.size(); ++i)
+    {
+        append_note(finished_, i, pending_);
+    }
+    finished_.clear();
+    pending_.sort();
+
+    std::size_t n_ready = 0;
+    while (n_ready < pending_.size() &&
+           pending_.start_idx[n_ready] < end_frame)
+    {
+        const NoteEvent note_event = pending_[n_ready];
+        const std::span<const int> pitch_bends = pending_.pitch_bends(n_ready);
+        for (NoteSink *sink : sinks_)
+        {
+            if (!sink->add_note(note_event, pitch_bends))
+            {
+                ok_ = false;
+                return false;
+            }
+        }
+        n_ready++;
+    }
+    n_notes_ += n_ready;
+
+    // keep the rest, which also frees the arena space of the notes passed on
+    scratch_.clear();
+    for (std::size_t i = n_ready; i < pending_.size(); ++i)
+    {
+        append_note(pending_, i, scratch_);
+    }
+    std::swap(pending_, scratch_);
+    return true;
+}
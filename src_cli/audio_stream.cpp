@@ -0,0 +1,452 @@
+#include "audio_stream.hpp"
+#include "IntegerRatio.h"
+#include "basicpitch.hpp"
+#include "mapped_wav.hpp"
+#include "parallel_flac.hpp"
+#include "pipe_audio.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <libnyquist/Decoders.h>
+#include <limits>
+
+using namespace basic_pitch::constants;
+
+namespace
+{
+// input frames downmixed at a time before resampling
+constexpr std::size_t DOWNMIX_BLOCK_SIZE = 4096;
+
+// output samples per segment with several resampling threads, about 5 s
+constexpr int64_t RESAMPLE_SEGMENT_LENGTH = 5 * SAMPLE_RATE;
+
+// out[i] is the weighted sum of the channels of frame i. With the channel
+// count known at compile time the compiler turns the inner loop into
+// shuffles and multiplies over several frames at once.
+template <int N_CHANNELS>
+void downmix_fixed(const float *samples, std::size_t n_frames,
+                   const float *weights, float *out)
+{
+    for (std::size_t i = 0; i < n_frames; ++i)
+    {
+        float sum = 0.0f;
+        for (int c = 0; c < N_CHANNELS; ++c)
+        {
+            sum += weights[c] * samples[i * N_CHANNELS + c];
+        }
+        out[i] = sum;
+    }
+}
+
+void downmix(const float *samples, std::size_t n_frames,
+             const std::vector<float> &weights, float *out)
+{
+    switch (weights.size())
+    {
+    case 1:
+        return downmix_fixed<1>(samples, n_frames, weights.data(), out);
+    case 2:
+        return downmix_fixed<2>(samples, n_frames, weights.data(), out);
+    case 4:
+        return downmix_fixed<4>(samples, n_frames, weights.data(), out);
+    case 6:
+        return downmix_fixed<6>(samples, n_frames, weights.data(), out);
+    case 8:
+        return downmix_fixed<8>(samples, n_frames, weights.data(), out);
+    default:
+        break;
+    }
+
+    // one channel at a time over the block, which stays in cache
+    const std::size_t n_channels = weights.size();
+    std::fill(out, out + n_frames, 0.0f);
+    for (std::size_t c = 0; c < n_channels; ++c)
+    {
+        for (std::size_t i = 0; i < n_frames; ++i)
+        {
+            out[i] += weights[c] * samples[i * n_channels + c];
+        }
+    }
+}
+} // namespace
+
+AudioStream::AudioStream(const std::string &filename,
+                         const AudioStreamConfig &config)
+{
+    // PCM WAV files are read in place; anything else is decoded up front
+    wav_ = MappedWav::open(filename);
+    if (wav_)
+    {
+        std::cout << "Reading " << wav_->bits_per_sample() << "-bit "
+                  << (wav_->is_float() ? "float" : "PCM")
+                  << " WAV without decoding" << std::endl;
+        n_channels_ = wav_->n_channels();
+        sample_rate_ = wav_->sample_rate();
+        n_input_frames_ = wav_->n_frames();
+    }
+    else
+    {
+        auto decoded = std::make_shared<nqr::AudioData>();
+        if (config.decode_threads > 1 &&
+            decode_flac_parallel(filename, config.decode_threads, *decoded))
+        {
+            std::cout << "Decoded FLAC frames on up to "
+                      << config.decode_threads << " threads" << std::endl;
+        }
+        else
+        {
+            // load the file with libnyquist
+            nqr::NyquistIO loader;
+            loader.Load(decoded.get(), filename);
+        }
+        decoded_ = std::move(decoded);
+        n_channels_ = decoded_->channelCount;
+        sample_rate_ = decoded_->sampleRate;
+        if (n_channels_ > 0)
+        {
+            n_input_frames_ = decoded_->samples.size() / n_channels_;
+        }
+    }
+
+    if (n_channels_ < 1)
+    {
+        std::cerr << "[ERROR] " << filename << " has no audio channels"
+                  << std::endl;
+        exit(1);
+    }
+
+    std::cout << "Input samples: " << n_input_frames_ << std::endl;
+    std::cout << "Length in seconds: "
+              << static_cast<double>(n_input_frames_) / sample_rate_
+              << std::endl;
+    std::cout << "Number of channels: " << n_channels_ << std::endl;
+
+    configure(config);
+}
+
+AudioStream::AudioStream(std::unique_ptr<PipeAudio> pipe,
+                         const AudioStreamConfig &config)
+    : pipe_(std::move(pipe))
+{
+    n_channels_ = pipe_->n_channels();
+    sample_rate_ = pipe_->sample_rate();
+    n_input_frames_ = std::numeric_limits<std::size_t>::max();
+
+    std::cout << "Reading " << pipe_->bits_per_sample() << "-bit "
+              << (pipe_->is_float() ? "float" : "PCM") << " audio at "
+              << sample_rate_ << " Hz from a pipe" << std::endl;
+    std::cout << "Number of channels: " << n_channels_ << std::endl;
+
+    configure(config);
+}
+
+AudioStream::AudioStream(const AudioStream &input,
+                         const AudioStreamConfig &config)
+    : wav_(input.wav_), decoded_(input.decoded_),
+      n_channels_(input.n_channels_), sample_rate_(input.sample_rate_),
+      n_input_frames_(input.n_input_frames_)
+{
+    configure(config);
+}
+
+void AudioStream::configure(const AudioStreamConfig &config)
+{
+    channel_weights_ = config.channel_weights;
+    if (config.channel >= n_channels_)
+    {
+        std::cerr << "[ERROR] no channel " << config.channel + 1 << " in "
+                  << n_channels_ << " channels" << std::endl;
+        exit(1);
+    }
+    else if (config.channel >= 0)
+    {
+        // the mix of the one channel
+        channel_weights_.assign(n_channels_, 0.0f);
+        channel_weights_[config.channel] = 1.0f;
+    }
+    else if (channel_weights_.empty())
+    {
+        // the mean of the channels; for stereo, (L + R) / 2 exactly
+        channel_weights_.assign(n_channels_, 1.0f / n_channels_);
+    }
+    else if (channel_weights_.size() != static_cast<std::size_t>(n_channels_))
+    {
+        std::cerr << "[ERROR] " << channel_weights_.size()
+                  << " channel weights given for " << n_channels_
+                  << " channels" << std::endl;
+        exit(1);
+    }
+    if (config.channel >= 0)
+    {
+        std::cout << "Reading channel " << config.channel + 1 << " of "
+                  << n_channels_ << std::endl;
+    }
+    else if (n_channels_ > 1)
+    {
+        std::cout << "Downmixing " << n_channels_ << " channels to mono"
+                  << std::endl;
+    }
+
+    // Check if resampling is needed
+    resample_quality_ = config.resample_quality;
+    if (sample_rate_ != SAMPLE_RATE)
+    {
+        std::cout << "Resampling from " << sample_rate_ << " Hz to "
+                  << SAMPLE_RATE << " Hz" << std::endl;
+
+        // Resampling using Oboe's resampler module
+        resampler_.reset(aaudio::resampler::MultiChannelResampler::make(
+            1, // Mono (1 channel)
+            sample_rate_, SAMPLE_RATE, config.resample_quality));
+
+        // the phase of the resampler repeats every ratio_denominator_ outputs
+        aaudio::resampler::IntegerRatio ratio(sample_rate_, SAMPLE_RATE);
+        ratio.reduce();
+        ratio_numerator_ = ratio.getNumerator();
+        ratio_denominator_ = ratio.getDenominator();
+        filter_taps_ = resampler_->getNumTaps();
+    }
+
+    if (pipe_)
+    {
+        // read front to back on this thread until the pipe ends
+        end_sample_ = std::numeric_limits<int64_t>::max();
+        length_ = -1;
+        return;
+    }
+
+    // output samples of the whole file
+    const int64_t total_length = output_length(n_input_frames_);
+    first_sample_ = std::clamp<int64_t>(config.first_sample, 0, total_length);
+    end_sample_ = config.end_sample < 0
+                      ? total_length
+                      : std::clamp(config.end_sample, first_sample_,
+                                   total_length);
+    length_ = end_sample_ - first_sample_;
+
+    if (resampler_ && config.resample_threads > 1)
+    {
+        // each segment gets a resampler of its own
+        resampler_.reset();
+        resample_threads_ = config.resample_threads;
+        next_segment_output_ = first_sample_;
+        std::cout << "Resampling on " << resample_threads_ << " threads"
+                  << std::endl;
+    }
+    else if (resampler_)
+    {
+        // start the resampler in phase ahead of the first sample and drop
+        // its outputs up to it
+        int64_t n_skip = seek_input(first_sample_, next_input_frame_);
+        std::vector<float> skipped(DOWNMIX_BLOCK_SIZE);
+        while (n_skip > 0)
+        {
+            const int n = static_cast<int>(
+                std::min<int64_t>(n_skip, DOWNMIX_BLOCK_SIZE));
+            read_input(skipped.data(), n);
+            n_skip -= n;
+        }
+    }
+    else
+    {
+        next_input_frame_ = static_cast<std::size_t>(first_sample_);
+    }
+}
+
+AudioStream::~AudioStream() = default;
+
+int64_t AudioStream::output_length(std::size_t n_input_frames) const
+{
+    if (!resampler_)
+    {
+        return static_cast<int64_t>(n_input_frames);
+    }
+    return static_cast<int64_t>(static_cast<double>(n_input_frames) *
+                                    SAMPLE_RATE / sample_rate_ +
+                                0.5);
+}
+
+void AudioStream::downmix_frames(std::size_t first, std::size_t n,
+                                 std::vector<float> &frames,
+                                 float *out) const
+{
+    const float *samples;
+    if (wav_)
+    {
+        // converted a block at a time, so only the block is held as floats
+        frames.resize(n * n_channels_);
+        wav_->read_frames(first, n, frames.data());
+        samples = frames.data();
+    }
+    else
+    {
+        samples = decoded_->samples.data() + first * n_channels_;
+    }
+    downmix(samples, n, channel_weights_, out);
+}
+
+void AudioStream::downmix_next_block()
+{
+    std::size_t n = std::min(DOWNMIX_BLOCK_SIZE,
+                             n_input_frames_ - next_input_frame_);
+    input_pos_ = 0;
+    if (pipe_)
+    {
+        frames_.resize(n * n_channels_);
+        n = pipe_->read_frames(n, frames_.data());
+        input_.resize(n);
+        downmix(frames_.data(), n, channel_weights_, input_.data());
+        next_input_frame_ += n;
+        if (n == 0)
+        {
+            // the end of the pipe gives the length of the output
+            n_input_frames_ = next_input_frame_;
+            end_sample_ = output_length(n_input_frames_);
+            length_ = end_sample_;
+        }
+        return;
+    }
+    input_.resize(n);
+    downmix_frames(next_input_frame_, n, frames_, input_.data());
+    next_input_frame_ += n;
+}
+
+int64_t AudioStream::seek_input(int64_t first_output,
+                                std::size_t &first_input) const
+{
+    // After k * denominator outputs the resampler has taken k * numerator
+    // input frames and is back at its first phase, so a new one started at
+    // that input frame gives the same samples once its filter history is
+    // the same. It starts enough periods earlier to fill the history.
+    const int64_t period = first_output / ratio_denominator_;
+    const int64_t start_period =
+        period - std::min<int64_t>(period, (filter_taps_ + ratio_numerator_ -
+                                            1) / ratio_numerator_);
+    first_input = static_cast<std::size_t>(start_period * ratio_numerator_);
+    return first_output - start_period * ratio_denominator_;
+}
+
+std::vector<float> AudioStream::resample_segment(int64_t first_output,
+                                                 int64_t n) const
+{
+    std::size_t next_frame = 0;
+    const int64_t n_skip = seek_input(first_output, next_frame);
+
+    std::unique_ptr<aaudio::resampler::MultiChannelResampler> resampler(
+        aaudio::resampler::MultiChannelResampler::make(
+            1, sample_rate_, SAMPLE_RATE, resample_quality_));
+
+    // past the end of the input the samples stay silent
+    std::vector<float> out(n_skip + n, 0.0f);
+    std::vector<float> frames;
+    std::vector<float> input(DOWNMIX_BLOCK_SIZE);
+    std::size_t n_done = 0;
+    while (n_done < out.size() && next_frame < n_input_frames_)
+    {
+        const std::size_t n_input =
+            std::min(DOWNMIX_BLOCK_SIZE, n_input_frames_ - next_frame);
+        downmix_frames(next_frame, n_input, frames, input.data());
+        next_frame += n_input;
+
+        std::size_t input_pos = 0;
+        while (input_pos < n_input && n_done < out.size())
+        {
+            int32_t n_used = 0;
+            n_done += resampler->process(
+                input.data() + input_pos,
+                static_cast<int32_t>(n_input - input_pos), out.data() + n_done,
+                static_cast<int32_t>(out.size() - n_done), &n_used);
+            input_pos += n_used;
+        }
+    }
+    out.erase(out.begin(), out.begin() + n_skip);
+    return out;
+}
+
+void AudioStream::schedule_segments()
+{
+    while (segments_.size() < static_cast<std::size_t>(resample_threads_) &&
+           next_segment_output_ < end_sample_)
+    {
+        const int64_t first = next_segment_output_;
+        const int64_t n =
+            std::min(RESAMPLE_SEGMENT_LENGTH, end_sample_ - first);
+        segments_.push_back(std::async(std::launch::async, [this, first, n]
+                                       { return resample_segment(first, n); }));
+        next_segment_output_ += n;
+    }
+}
+
+void AudioStream::read_segments(float *out, int n)
+{
+    int n_done = 0;
+    while (n_done < n)
+    {
+        if (segment_pos_ == segment_.size())
+        {
+            schedule_segments();
+            segment_ = segments_.front().get();
+            segments_.pop_front();
+            segment_pos_ = 0;
+            // start the next one while this one is read
+            schedule_segments();
+        }
+        const int n_copy = static_cast<int>(
+            std::min<std::size_t>(segment_.size() - segment_pos_, n - n_done));
+        std::copy_n(segment_.begin() + segment_pos_, n_copy, out + n_done);
+        segment_pos_ += n_copy;
+        n_done += n_copy;
+    }
+}
+
+void AudioStream::read_input(float *out, int n)
+{
+    int n_done = 0;
+    while (n_done < n)
+    {
+        if (input_pos_ == input_.size())
+        {
+            if (next_input_frame_ == n_input_frames_)
+            {
+                // the input ran out before the rounded output length; the
+                // rest is silence
+                std::fill(out + n_done, out + n, 0.0f);
+                return;
+            }
+            downmix_next_block();
+        }
+
+        const int n_input = static_cast<int>(input_.size() - input_pos_);
+        if (!resampler_)
+        {
+            const int n_copy = std::min(n_input, n - n_done);
+            std::copy_n(input_.begin() + input_pos_, n_copy, out + n_done);
+            input_pos_ += n_copy;
+            n_done += n_copy;
+            continue;
+        }
+        int32_t n_used = 0;
+        n_done += resampler_->process(input_.data() + input_pos_, n_input,
+                                      out + n_done, n - n_done, &n_used);
+        input_pos_ += n_used;
+    }
+}
+
+int AudioStream::read(float *out, int max_samples)
+{
+    int n = static_cast<int>(
+        std::min<int64_t>(max_samples, end_sample_ - first_sample_ - n_read_));
+    if (resample_threads_ > 1)
+    {
+        read_segments(out, n);
+    }
+    else
+    {
+        read_input(out, n);
+    }
+    // a pipe can end in the middle of the block
+    n = static_cast<int>(std::clamp<int64_t>(
+        end_sample_ - first_sample_ - n_read_, 0, n));
+    n_read_ += n;
+    return n;
+}
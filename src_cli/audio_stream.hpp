@@ -0,0 +1,144 @@
+#ifndef AUDIO_STREAM_HPP
+#define AUDIO_STREAM_HPP
+
+#include "MultiChannelResampler.h"
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <libnyquist/Common.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+class MappedWav;
+class PipeAudio;
+
+// How a file is turned into mono audio at SAMPLE_RATE
+struct AudioStreamConfig
+{
+    using Quality = aaudio::resampler::MultiChannelResampler::Quality;
+
+    Quality resample_quality = Quality::Best;
+    // weight of each channel in the mono mix; empty for the mean
+    std::vector<float> channel_weights;
+    // the one channel to read instead of a mix, -1 for the mix
+    int channel = -1;
+    // threads resampling segments of the file ahead of the reader; the
+    // samples are the same as with one. Not for pipes.
+    int resample_threads = 1;
+    // threads decoding runs of FLAC frames at once; other formats are
+    // decoded on one
+    int decode_threads = 1;
+    // Samples [first_sample, end_sample) of the mono audio to read, -1 for
+    // the end of the file. Reading starts at the input frames they are made
+    // of, with the same values as when the whole file is read. Not for
+    // pipes.
+    int64_t first_sample = 0;
+    int64_t end_sample = -1;
+};
+
+// Mono audio at SAMPLE_RATE read in blocks from a file. Each block is
+// downmixed and resampled as it is read, so no full-length mono or
+// resampled copy of the file is made; the samples are the same as
+// downmixing and resampling the whole file at once. PCM WAV files are
+// mapped and converted block by block, so a part of them is read without
+// touching the rest; other formats are decoded first. Audio from a pipe is
+// read block by block as well, up to its end.
+class AudioStream
+{
+  public:
+    // Open the file; exits if it cannot be transcribed
+    explicit AudioStream(const std::string &filename,
+                         const AudioStreamConfig &config = {});
+    // Read from a pipe, whose length is only known at its end
+    explicit AudioStream(std::unique_ptr<PipeAudio> pipe,
+                         const AudioStreamConfig &config = {});
+    // Read the file of another stream with a config of its own, e.g. for
+    // another channel, sharing its mapped or decoded samples; not for pipes
+    AudioStream(const AudioStream &input, const AudioStreamConfig &config);
+    ~AudioStream();
+
+    // mono samples at SAMPLE_RATE the stream produces in total, from
+    // config.first_sample on; -1 for a pipe until read() has reached its end
+    int64_t length() const { return length_; }
+
+    // channels of the input
+    int n_channels() const { return n_channels_; }
+
+    // Fill up to max_samples of `out`; returns how many, 0 at the end
+    int read(float *out, int max_samples);
+
+  private:
+    // set up the downmix and resampling once the input is open
+    void configure(const AudioStreamConfig &config);
+
+    // mono samples at SAMPLE_RATE made of n input frames
+    int64_t output_length(std::size_t n_input_frames) const;
+
+    // downmix n input frames from `first` into out, converting WAV
+    // samples in `frames`
+    void downmix_frames(std::size_t first, std::size_t n,
+                        std::vector<float> &frames, float *out) const;
+
+    // downmix the next block of input frames into input_
+    void downmix_next_block();
+
+    // The input frame a resampler starts at to give the output from
+    // first_output on, and how many of its outputs come before that
+    int64_t seek_input(int64_t first_output, std::size_t &first_input) const;
+
+    // Resample n output samples from first_output with a resampler of its
+    // own; safe to run on any thread
+    std::vector<float> resample_segment(int64_t first_output,
+                                        int64_t n) const;
+
+    // keep resample_threads_ segments in flight
+    void schedule_segments();
+
+    // fill n samples from the resampled segments
+    void read_segments(float *out, int n);
+
+    // fill n samples from the downmixed input, through resampler_ if set
+    void read_input(float *out, int n);
+
+    // one of the three is set; a file can be read by several streams
+    std::shared_ptr<const MappedWav> wav_;
+    std::shared_ptr<const nqr::AudioData> decoded_;
+    std::unique_ptr<PipeAudio> pipe_;
+    int n_channels_ = 0;
+    int sample_rate_ = 0;
+    AudioStreamConfig::Quality resample_quality_;
+    std::unique_ptr<aaudio::resampler::MultiChannelResampler> resampler_;
+    std::vector<float> channel_weights_;
+    // the most for a pipe until its end is reached
+    std::size_t n_input_frames_ = 0;
+    std::size_t next_input_frame_ = 0;
+    // the samples read, from the whole file's output
+    int64_t first_sample_ = 0;
+    int64_t end_sample_ = 0;
+    int64_t length_ = 0;
+    int64_t n_read_ = 0;
+
+    // a block of WAV frames converted to float
+    std::vector<float> frames_;
+
+    // downmixed input waiting to be resampled
+    std::vector<float> input_;
+    std::size_t input_pos_ = 0;
+
+    // the resampling ratio in lowest terms and the filter length, for
+    // resamplers starting in the middle of the file
+    int32_t ratio_numerator_ = 1;
+    int32_t ratio_denominator_ = 1;
+    int filter_taps_ = 0;
+
+    // with several threads: segments being resampled, in order, and the
+    // one being read
+    int resample_threads_ = 1;
+    int64_t next_segment_output_ = 0;
+    std::deque<std::future<std::vector<float>>> segments_;
+    std::vector<float> segment_;
+    std::size_t segment_pos_ = 0;
+};
+
+#endif // AUDIO_STREAM_HPP
@@ -1,149 +1,1117 @@
+#include "audio_stream.hpp"
 #include "basicpitch.hpp"
-#include "MultiChannelResampler.h"
+#include "pipe_audio.hpp"
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <csignal>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <libnyquist/Common.h>
-#include <libnyquist/Decoders.h>
-#include <libnyquist/Encoders.h>
+#include <limits>
 #include <map>
+#include <memory>
 #include <numeric>
+#include <random>
 #include <ranges>
-#include <sstream>
 #include <stddef.h>
+#include <thread>
 #include <tuple>
+#include <type_traits>
+#include <unistd.h>
 #include <vector>
 
-using namespace nqr;
 using namespace basic_pitch::constants;
 
-static std::vector<float> load_audio_file(std::string filename)
+static void usage(const char *argv0)
 {
-    // load a wav file with libnyquist
-    std::shared_ptr<AudioData> fileData = std::make_shared<AudioData>();
-    NyquistIO loader;
-    loader.Load(fileData.get(), filename);
+    std::cerr
+        << "Usage: " << argv0 << " [options] <wav file> <out dir>\n"
+        << "       " << argv0 << " [options] --live <path> <wav file>\n"
+        << "       " << argv0 << " --benchmark-resampler\n"
+        << "The wav file can be - for a WAV stream or raw samples on stdin, "
+           "which are\n"
+        << "transcribed as they arrive, and the out dir - to write the one "
+           "output format\n"
+        << "to stdout, with the log on stderr.\n"
+        << "Options:\n"
+        << "  --onset-threshold <x>  onset peak threshold (default "
+        << ONSET_THRESHOLD << ")\n"
+        << "  --frame-threshold <x>  note frame threshold (default "
+        << FRAME_THRESHOLD << ")\n"
+        << "  --min-note-len <n>     minimum note length in frames (default "
+        << MIN_NOTE_LEN << ")\n"
+        << "  --energy-tol <n>       frames below threshold that end a note "
+           "(default "
+        << ENERGY_TOL << ")\n"
+        << "  --no-melodia           disable the melodia trick\n"
+        << "  --no-pitch-bends       do not write pitch bends\n"
+        << "  --thin-pitch-bends     drop repeated pitch bends\n"
+        << "  --pitch-bend-tolerance <n>\n"
+        << "                         also drop bends within n contour bins "
+           "(1/3 semitone)\n"
+        << "                         of the last one written\n"
+        << "  --tempo <bpm>          MIDI tempo (default " << MIDI_TEMPO_BPM
+        << ")\n"
+        << "  --program <n>          MIDI program (default " << MIDI_PROGRAM
+        << ")\n"
+        << "  --min-pitch <n>        lowest MIDI pitch to transcribe (default "
+        << MIDI_OFFSET << ")\n"
+        << "  --max-pitch <n>        highest MIDI pitch to transcribe (default "
+        << MIDI_OFFSET + MAX_FREQ_IDX << ")\n"
+        << "  --start <s>            only the notes starting at or after s "
+           "seconds; the\n"
+        << "                         audio before is not read\n"
+        << "  --end <s>              only the notes starting before s seconds; "
+           "the audio\n"
+        << "                         after is not read\n"
+        << "                         With either, notes anywhere in the range "
+           "can differ\n"
+        << "                         from a whole-file run: note tracking is "
+           "not local\n"
+        << "  --benchmark            time each post-processing stage under "
+           "several settings\n"
+        << "  --benchmark-resampler  time resampling to " << SAMPLE_RATE
+        << " Hz at each quality and exit\n"
+        << "  --resample-quality <q> fastest, low, medium, high or best "
+           "(default)\n"
+        << "  --resample-threads <n> resample segments of the file on n "
+           "threads ahead of\n"
+        << "                         inference (default 1)\n"
+        << "  --decode-threads <n>   decode FLAC files on n threads "
+           "(default 1)\n"
+        << "  --raw <format>         stdin has raw interleaved s16 or f32 "
+           "samples\n"
+        << "  --raw-rate <hz>        sample rate of the raw samples (default "
+        << SAMPLE_RATE << ")\n"
+        << "  --raw-channels <n>     channels of the raw samples (default 1)\n"
+        << "  --channel-weights <list>\n"
+        << "                         comma-separated weight of each channel "
+           "in the mono\n"
+        << "                         mix (default: the mean of the "
+           "channels)\n"
+        << "  --per-channel          transcribe each channel on its own, "
+           "batched through the\n"
+        << "                         model together, into a MIDI track and "
+           "files per channel\n"
+        << "  --save-posteriorgram   also write the model outputs to "
+           "<out dir>/<name>.bppg\n"
+        << "  --save-npy             also write the model outputs as .npy "
+           "files\n"
+        << "  --from-posteriorgram   the input is a .bppg file; skip "
+           "inference\n"
+        << "  --precision <type>     posteriorgram storage: float32 (default), "
+           "uint16\n"
+        << "                         or uint8; less memory for long inputs\n"
+        << "  --sparse               store only activations above a floor "
+           "(default "
+        << basic_pitch::SPARSE_ACTIVATION_FLOOR << ")\n"
+        << "  --sparse-floor <x>     --sparse with the given floor\n"
+        << "  --formats <list>       comma-separated outputs, written in one "
+           "pass:\n"
+        << "                         mid (default), csv, json, bin (binary "
+           "note records),\n"
+        << "                         idx (time-range index of the notes)\n"
+        << "  --live <path>          write each MIDI message to path (e.g. a "
+           "FIFO) as\n"
+        << "                         soon as it is final, instead of the "
+           "output files\n"
+        << "  --realtime             with --live, feed the audio at its real "
+           "rate\n";
+}
 
-    std::cout << "Input samples: "
-              << fileData->samples.size() / fileData->channelCount << std::endl;
-    std::cout << "Length in seconds: " << fileData->lengthSeconds << std::endl;
-    std::cout << "Number of channels: " << fileData->channelCount << std::endl;
+static bool parse_float(const char *str, float &value)
+{
+    char *end = nullptr;
+    value = std::strtof(str, &end);
+    return end != str && *end == '\0';
+}
 
-    if (fileData->channelCount != 2 && fileData->channelCount != 1)
+static bool parse_int(const char *str, int &value)
+{
+    char *end = nullptr;
+    value = static_cast<int>(std::strtol(str, &end, 10));
+    return end != str && *end == '\0';
+}
+
+// Time dropping the pitch bends of overlapping notes on random notes a few
+// frames apart, long enough that hundreds to thousands sound at once as in
+// sustained material such as pads and organ
+static void benchmark_overlapping_bends()
+{
+    using clock = std::chrono::steady_clock;
+
+    // notes and the longest note in frames
+    const std::pair<int, int> cases[] = {{10000, 62}, {10000, 5012},
+                                         {50000, 5012}};
+
+    std::cout << "\nOverlapping pitch bend benchmark (random notes, 4 frames "
+                 "apart on average)"
+              << std::endl;
+    std::cout << "notes\tlongest\tms\tdropped" << std::endl;
+    std::mt19937 rng(0);
+    for (const auto &[n_notes, max_length] : cases)
     {
-        std::cerr
-            << "[ERROR] basicpitch.cpp only supports mono and stereo audio"
-            << std::endl;
-        exit(1);
+        std::uniform_int_distribution<int> start(0, 4 * n_notes);
+        std::uniform_int_distribution<int> length(MIN_NOTE_LEN + 1,
+                                                  max_length);
+        basic_pitch::NoteEventList note_events;
+        note_events.reserve(n_notes);
+        for (int i = 0; i < n_notes; ++i)
+        {
+            const int start_idx = start(rng);
+            note_events.push_back(
+                {start_idx, start_idx + length(rng), MIDI_OFFSET, 1.0f});
+            note_events.assign_pitch_bends(i, 1)[0] = 0;
+        }
+
+        auto t0 = clock::now();
+        basic_pitch::drop_overlapping_pitch_bends(note_events);
+        auto t1 = clock::now();
+
+        std::size_t n_dropped = 0;
+        for (std::size_t i = 0; i < note_events.size(); ++i)
+        {
+            n_dropped += !note_events.has_pitch_bends(i);
+        }
+        std::cout << n_notes << "\t" << max_length << "\t"
+                  << std::chrono::duration<double, std::milli>(t1 - t0).count()
+                  << "\t" << n_dropped << std::endl;
+    }
+}
+
+// Run the post-processing stages of convert_to_midi separately under a few
+// settings and print how long each one takes
+template <typename Result>
+static void benchmark_post_processing(
+    const Result &inference_result,
+    const basic_pitch::TranscriptionConfig &base_config)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::vector<std::pair<std::string, basic_pitch::TranscriptionConfig>>
+        settings;
+    settings.emplace_back("given", base_config);
+
+    basic_pitch::TranscriptionConfig no_bends = base_config;
+    no_bends.include_pitch_bends = false;
+    settings.emplace_back("no bends", no_bends);
+
+    if (base_config.include_pitch_bends &&
+        base_config.pitch_bend_tolerance < 0)
+    {
+        basic_pitch::TranscriptionConfig thin_bends = base_config;
+        thin_bends.pitch_bend_tolerance = 0;
+        settings.emplace_back("thin bends", thin_bends);
     }
 
-    // number of samples per channel
-    std::size_t N = fileData->samples.size() / fileData->channelCount;
+    basic_pitch::TranscriptionConfig no_melodia = base_config;
+    no_melodia.use_melodia_trick = false;
+    settings.emplace_back("no melodia", no_melodia);
+
+    basic_pitch::TranscriptionConfig cheapest = no_bends;
+    cheapest.use_melodia_trick = false;
+    cheapest.onset_threshold = 0.7f;
+    cheapest.frame_threshold = 0.5f;
+    settings.emplace_back("cheapest", cheapest);
 
-    std::vector<float> mono_audio(N);
+    int n_frames = inference_result.notes.dimension(0);
 
-    if (fileData->channelCount == 1)
+    struct StageTimes
     {
-        for (std::size_t i = 0; i < N; ++i)
+        double notes_ms, bends_ms, midi_ms;
+        std::size_t n_notes, midi_size;
+    };
+    std::vector<StageTimes> results;
+
+    for (const auto &[name, config] : settings)
+    {
+        auto ms = [](clock::time_point a, clock::time_point b)
+        { return std::chrono::duration<double, std::milli>(b - a).count(); };
+
+        auto t0 = clock::now();
+        basic_pitch::NoteEventList note_events =
+            basic_pitch::output_to_notes_polyphonic(inference_result, config);
+        auto t1 = clock::now();
+        if (config.include_pitch_bends)
         {
-            mono_audio[i] = fileData->samples[i];
+            basic_pitch::add_pitch_bends(inference_result.contours,
+                                         note_events,
+                                         inference_result.pitch_range);
         }
+        auto t2 = clock::now();
+        std::vector<uint8_t> midi_bytes =
+            basic_pitch::note_events_to_midi(note_events, config);
+        auto t3 = clock::now();
+
+        results.push_back({ms(t0, t1), ms(t1, t2), ms(t2, t3),
+                           note_events.size(), midi_bytes.size()});
     }
-    else
+
+    std::cout << "\nPost-processing benchmark (" << n_frames
+              << " frames, times in ms)" << std::endl;
+    std::cout << "setting\tnotes\tbends\tmidi\ttotal\t#notes\tmidi bytes"
+              << std::endl;
+    for (std::size_t i = 0; i < settings.size(); ++i)
+    {
+        const StageTimes &r = results[i];
+        std::cout << settings[i].first << "\t" << r.notes_ms << "\t"
+                  << r.bends_ms << "\t" << r.midi_ms << "\t"
+                  << r.notes_ms + r.bends_ms + r.midi_ms << "\t" << r.n_notes
+                  << "\t" << r.midi_size << std::endl;
+    }
+
+    benchmark_overlapping_bends();
+}
+
+// resampler qualities by name, fastest first
+static const std::vector<std::pair<std::string, AudioStreamConfig::Quality>>
+    RESAMPLE_QUALITIES = {
+        {"fastest", AudioStreamConfig::Quality::Fastest},
+        {"low", AudioStreamConfig::Quality::Low},
+        {"medium", AudioStreamConfig::Quality::Medium},
+        {"high", AudioStreamConfig::Quality::High},
+        {"best", AudioStreamConfig::Quality::Best},
+};
+
+static bool parse_resample_quality(const std::string &name,
+                                   AudioStreamConfig::Quality &quality)
+{
+    for (const auto &[quality_name, value] : RESAMPLE_QUALITIES)
     {
-        // Stereo case: downmix to mono
-        for (std::size_t i = 0; i < N; ++i)
+        if (quality_name == name)
         {
-            mono_audio[i] =
-                (fileData->samples[2 * i] + fileData->samples[2 * i + 1]) /
-                2.0f;
+            quality = value;
+            return true;
         }
     }
+    return false;
+}
 
-    // Check if resampling is needed
-    if (fileData->sampleRate != SAMPLE_RATE)
+static bool parse_weights(const std::string &list,
+                          std::vector<float> &weights)
+{
+    weights.clear();
+    std::size_t begin = 0;
+    while (begin <= list.size())
     {
-        std::cout << "Resampling from " << fileData->sampleRate << " Hz to "
-                  << SAMPLE_RATE << " Hz" << std::endl;
+        std::size_t end = std::min(list.find(',', begin), list.size());
+        float weight = 0.0f;
+        if (!parse_float(list.substr(begin, end - begin).c_str(), weight))
+        {
+            return false;
+        }
+        weights.push_back(weight);
+        begin = end + 1;
+    }
+    return true;
+}
 
-        // Resampling using Oboe's resampler module
-        aaudio::resampler::MultiChannelResampler *resampler =
-            aaudio::resampler::MultiChannelResampler::make(
-                1, // Mono (1 channel)
-                fileData->sampleRate, SAMPLE_RATE,
-                aaudio::resampler::MultiChannelResampler::Quality::Best);
+// Resample a minute of noise from common input rates at each quality, one
+// frame per call and in blocks, and print the input samples per second
+static void benchmark_resampler()
+{
+    using clock = std::chrono::steady_clock;
+    using aaudio::resampler::MultiChannelResampler;
 
-        int numInputFrames =
-            N; // Since the audio is mono, numInputFrames is just N
-        int numOutputFrames =
-            static_cast<int>(static_cast<double>(numInputFrames) * SAMPLE_RATE /
-                                 fileData->sampleRate +
-                             0.5);
+    constexpr int BLOCK_SIZE = 4096;
+    const int input_rates[] = {16000, 44100, 48000};
 
-        std::vector<float> resampledAudio(
-            numOutputFrames); // Resampled mono audio
+    std::cout << "\nResampler benchmark (60 s of noise to " << SAMPLE_RATE
+              << " Hz, Msamples/s of input)" << std::endl;
+    std::cout << "rate\tquality\tframe\tblock\tspeedup\tmax diff"
+              << std::endl;
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+    for (int input_rate : input_rates)
+    {
+        std::vector<float> input(60 * input_rate);
+        std::ranges::generate(input, [&] { return noise(rng); });
+        // room for the rounding of the output length
+        std::vector<float> by_frame(60 * SAMPLE_RATE + 2);
+        std::vector<float> by_block(by_frame.size());
 
-        float *inputBuffer = mono_audio.data();
-        float *outputBuffer = resampledAudio.data();
+        for (const auto &[name, quality] : RESAMPLE_QUALITIES)
+        {
+            std::unique_ptr<MultiChannelResampler> resampler(
+                MultiChannelResampler::make(1, input_rate, SAMPLE_RATE,
+                                            quality));
+            auto t0 = clock::now();
+            std::size_t n_frame_out = 0;
+            for (float sample : input)
+            {
+                resampler->writeNextFrame(&sample);
+                while (!resampler->isWriteNeeded())
+                {
+                    resampler->readNextFrame(&by_frame[n_frame_out++]);
+                }
+            }
+            auto t1 = clock::now();
 
-        int inputFramesLeft = numInputFrames;
-        int numResampledFrames = 0;
+            resampler.reset(MultiChannelResampler::make(1, input_rate,
+                                                        SAMPLE_RATE, quality));
+            auto t2 = clock::now();
+            std::size_t n_block_out = 0;
+            for (std::size_t i = 0; i < input.size(); i += BLOCK_SIZE)
+            {
+                const int n_in = static_cast<int>(
+                    std::min<std::size_t>(BLOCK_SIZE, input.size() - i));
+                n_block_out += resampler->process(
+                    input.data() + i, n_in, by_block.data() + n_block_out,
+                    static_cast<int>(by_block.size() - n_block_out));
+            }
+            auto t3 = clock::now();
+
+            float max_diff = 0.0f;
+            for (std::size_t i = 0; i < std::min(n_frame_out, n_block_out);
+                 ++i)
+            {
+                max_diff =
+                    std::max(max_diff, std::abs(by_frame[i] - by_block[i]));
+            }
+            auto msps = [&](clock::time_point a, clock::time_point b)
+            {
+                return input.size() /
+                       std::chrono::duration<double, std::micro>(b - a)
+                           .count();
+            };
+            std::cout << input_rate << "\t" << name << "\t" << msps(t0, t1)
+                      << "\t" << msps(t2, t3) << "\t"
+                      << msps(t2, t3) / msps(t0, t1) << "\t" << max_diff
+                      << std::endl;
+        }
+    }
+}
+
+struct CliOptions
+{
+    basic_pitch::TranscriptionConfig config;
+    bool benchmark = false;
+    bool benchmark_resampler = false;
+    AudioStreamConfig audio;
+    bool save_posteriorgram = false;
+    bool save_npy = false;
+    bool from_posteriorgram = false;
+    std::string precision = "float32";
+    bool sparse = false;
+    float sparse_floor = basic_pitch::SPARSE_ACTIVATION_FLOOR;
+    std::vector<std::string> formats = {"mid"};
+    std::string live_path;
+    bool realtime = false;
+    // --start and --end in seconds, -1 for the end of the input
+    float start_time = 0.0f;
+    float end_time = -1.0f;
+    // the part of the input the model runs over for them
+    basic_pitch::ModelSection section;
+    // raw samples on stdin: "s16" or "f32", empty for a WAV stream
+    std::string raw_format;
+    int raw_rate = SAMPLE_RATE;
+    int raw_channels = 1;
+    bool per_channel = false;
+};
+
+// the input or output path for stdin or stdout
+static const std::string STDIO_PATH = "-";
+
+// frames of note tracking on either side of --start and --end, about a
+// second. This does not bound how far a change at the cut reaches: peaks
+// are walked latest first and each note clears energy that the next one
+// would have drawn on, so notes anywhere in the range can still differ from
+// the whole input.
+constexpr int SECTION_CONTEXT_FRAMES = ANNOTATIONS_FPS;
 
-        while (inputFramesLeft > 0 && numResampledFrames < numOutputFrames)
+// Passes on to `sink` the notes of a ModelSection starting in frames
+// [first_frame, end_frame) of the whole input, moved from the frames of the
+// section to those of the whole input
+class SectionNoteSink : public basic_pitch::NoteSink
+{
+  public:
+    SectionNoteSink(basic_pitch::NoteSink &sink, int frame_offset,
+                    int first_frame, int end_frame)
+        : sink_(sink), frame_offset_(frame_offset), first_frame_(first_frame),
+          end_frame_(end_frame)
+    {
+    }
+
+    bool add_note(const basic_pitch::NoteEvent &note_event,
+                  std::span<const int> pitch_bends) override
+    {
+        basic_pitch::NoteEvent moved = note_event;
+        moved.start_idx += frame_offset_;
+        moved.end_idx += frame_offset_;
+        if (moved.start_idx < first_frame_ || moved.start_idx >= end_frame_)
         {
-            if (resampler->isWriteNeeded())
+            return true;
+        }
+        return sink_.add_note(moved, pitch_bends);
+    }
+
+    bool finish() override { return sink_.finish(); }
+
+  private:
+    basic_pitch::NoteSink &sink_;
+    int frame_offset_;
+    int first_frame_;
+    int end_frame_;
+};
+
+// output formats and the extensions of their files
+static const std::map<std::string, std::string> OUTPUT_FORMATS = {
+    {"mid", ".mid"},
+    {"csv", ".csv"},
+    {"json", ".json"},
+    {"bin", ".notes.bin"},
+    {"idx", ".notes.idx"},
+};
+
+static bool parse_formats(const std::string &list,
+                          std::vector<std::string> &formats)
+{
+    formats.clear();
+    std::size_t begin = 0;
+    while (begin <= list.size())
+    {
+        std::size_t end = std::min(list.find(',', begin), list.size());
+        std::string format = list.substr(begin, end - begin);
+        if (!OUTPUT_FORMATS.contains(format) ||
+            std::ranges::find(formats, format) != formats.end())
+        {
+            return false;
+        }
+        formats.push_back(format);
+        begin = end + 1;
+    }
+    return true;
+}
+
+// The audio of the input file, or of stdin for STDIO_PATH; exits if it
+// cannot be transcribed
+static std::unique_ptr<AudioStream> open_audio(const std::string &input_file,
+                                               const CliOptions &options)
+{
+    if (input_file != STDIO_PATH)
+    {
+        return std::make_unique<AudioStream>(input_file, options.audio);
+    }
+
+    std::unique_ptr<PipeAudio> pipe;
+    if (options.raw_format.empty())
+    {
+        pipe = PipeAudio::open_wav(STDIN_FILENO);
+        if (!pipe)
+        {
+            std::cerr << "[ERROR] stdin is not a 16-bit or 24-bit PCM or "
+                         "32-bit float WAV stream; use --raw for raw samples"
+                      << std::endl;
+            exit(1);
+        }
+    }
+    else
+    {
+        pipe = PipeAudio::open_raw(STDIN_FILENO,
+                                   options.raw_format == "s16"
+                                       ? WavSampleFormat::Int16
+                                       : WavSampleFormat::Float32,
+                                   options.raw_rate, options.raw_channels);
+    }
+    return std::make_unique<AudioStream>(std::move(pipe), options.audio);
+}
+
+// One stream per channel of the input file, for --per-channel; the later
+// ones share the samples of the first. Exits if the file cannot be
+// transcribed.
+static std::vector<std::unique_ptr<AudioStream>>
+open_channels(const std::string &input_file, AudioStreamConfig config)
+{
+    config.channel = 0;
+    std::vector<std::unique_ptr<AudioStream>> channels;
+    channels.push_back(std::make_unique<AudioStream>(input_file, config));
+    for (config.channel = 1; config.channel < channels[0]->n_channels();
+         ++config.channel)
+    {
+        channels.push_back(std::make_unique<AudioStream>(*channels[0], config));
+    }
+    return channels;
+}
+
+// Run the model over the channels at once, with the posteriorgrams stored
+// as T, and write the notes of channel c to channel_sinks[c]
+template <typename T>
+static bool
+transcribe_channels(std::span<const std::unique_ptr<AudioStream>> channels,
+                    const CliOptions &options,
+                    std::span<const std::vector<basic_pitch::NoteSink *>>
+                        channel_sinks)
+{
+    std::vector<basic_pitch::AudioReader> readers;
+    for (const std::unique_ptr<AudioStream> &audio : channels)
+    {
+        readers.push_back([&audio](float *out, int max_samples)
+                          { return audio->read(out, max_samples); });
+    }
+    std::vector<basic_pitch::BasicInferenceResult<T>> inference_results =
+        basic_pitch::ort_inference_channels<T>(
+            readers, channels[0]->length(), options.config.pitch_range,
+            options.section);
+    std::cout << "Ran the model over " << channels.size()
+              << " channels in one batch per window" << std::endl;
+
+    for (std::size_t c = 0; c < channels.size(); ++c)
+    {
+        std::cout << "Channel " << c + 1 << ":" << std::endl;
+        if (!basic_pitch::convert_to_notes(inference_results[c],
+                                           channel_sinks[c], options.config))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Get the posteriorgram stored as T, by inference or from a cache, and
+// write its notes to the sinks
+template <typename T>
+static bool transcribe(const std::string &input_file,
+                       const std::filesystem::path &output_stem,
+                       const CliOptions &options,
+                       std::span<basic_pitch::NoteSink *const> sinks)
+{
+    basic_pitch::BasicInferenceResult<T> inference_result;
+    if (options.from_posteriorgram)
+    {
+        // skip inference, only re-run the post-processing
+        auto loaded = basic_pitch::load_posteriorgram(input_file);
+        if (!loaded)
+        {
+            return false;
+        }
+        if constexpr (std::is_same_v<T, float>)
+        {
+            inference_result = std::move(*loaded);
+        }
+        else
+        {
+            inference_result = basic_pitch::quantize_posteriorgram<T>(*loaded);
+        }
+        std::cout << "Loaded posteriorgram with "
+                  << inference_result.notes.dimension(0) << " frames"
+                  << std::endl;
+    }
+    else
+    {
+        // decoded audio is downmixed and resampled block by block as the
+        // model windows are filled
+        AudioStream audio(input_file, options.audio);
+        inference_result = basic_pitch::ort_inference_as<T>(
+            [&](float *out, int max_samples)
+            { return audio.read(out, max_samples); },
+            audio.length(), options.config.pitch_range, options.section);
+    }
+
+    if constexpr (std::is_same_v<T, float>)
+    {
+        if (options.save_posteriorgram)
+        {
+            std::filesystem::path cache_file = output_stem;
+            cache_file += ".bppg";
+            if (!basic_pitch::save_posteriorgram(cache_file, inference_result))
             {
-                resampler->writeNextFrame(inputBuffer);
-                inputBuffer++;
-                inputFramesLeft--;
+                return false;
             }
-            else
+            std::cout << "Wrote posteriorgram to: " << cache_file << std::endl;
+        }
+
+        if (options.save_npy)
+        {
+            if (!basic_pitch::save_posteriorgram_npy(output_stem,
+                                                     inference_result))
             {
-                resampler->readNextFrame(outputBuffer);
-                outputBuffer++;
-                numResampledFrames++;
+                return false;
             }
+            std::cout << "Wrote posteriorgram .npy files to: " << output_stem
+                      << ".{notes,onsets,contours}.npy" << std::endl;
         }
+    }
+
+    if (options.benchmark)
+    {
+        benchmark_post_processing(inference_result, options.config);
+    }
+
+    // Call the function to convert the output to notes
+    return basic_pitch::convert_to_notes(inference_result, sinks,
+                                         options.config);
+}
 
-        while (!resampler->isWriteNeeded() &&
-               numResampledFrames < numOutputFrames)
+// Same as transcribe with the sparse posteriorgram
+static bool transcribe_sparse(const std::string &input_file,
+                              const CliOptions &options,
+                              std::span<basic_pitch::NoteSink *const> sinks)
+{
+    basic_pitch::SparseInferenceResult inference_result;
+    if (options.from_posteriorgram)
+    {
+        auto loaded = basic_pitch::load_posteriorgram(input_file);
+        if (!loaded)
         {
-            resampler->readNextFrame(outputBuffer);
-            outputBuffer++;
-            numResampledFrames++;
+            return false;
         }
+        inference_result =
+            basic_pitch::sparsify_posteriorgram(*loaded, options.sparse_floor);
+    }
+    else
+    {
+        AudioStream audio(input_file, options.audio);
+        inference_result = basic_pitch::ort_inference_sparse(
+            [&](float *out, int max_samples)
+            { return audio.read(out, max_samples); },
+            audio.length(), options.sparse_floor, options.config.pitch_range,
+            options.section);
+    }
+
+    std::cout << "Sparse posteriorgram: "
+              << (inference_result.notes.memory_bytes() +
+                  inference_result.onsets.memory_bytes() +
+                  inference_result.contours.memory_bytes())
+              << " bytes for " << inference_result.notes.n_frames
+              << " frames" << std::endl;
+
+    if (options.benchmark)
+    {
+        benchmark_post_processing(inference_result, options.config);
+    }
+
+    return basic_pitch::convert_to_notes(inference_result, sinks,
+                                         options.config);
+}
 
-        delete resampler;
+// samples of a pipe transcribed at a time, about 0.7 s
+constexpr int STREAM_BLOCK_SIZE = 16384;
 
-        return resampledAudio;
+// Transcribe the audio as it is read, e.g. from stdin, without holding it
+// or its posteriorgram, and write the notes to the sinks
+static bool transcribe_stream(const std::string &input_file,
+                              const CliOptions &options,
+                              std::span<basic_pitch::NoteSink *const> sinks)
+{
+    std::unique_ptr<AudioStream> audio = open_audio(input_file, options);
+    basic_pitch::StreamingTranscriber transcriber(sinks, options.config);
+
+    std::vector<float> block(STREAM_BLOCK_SIZE);
+    int64_t n_read = 0;
+    bool ok = true;
+    int length;
+    while (ok && (length = audio->read(block.data(), STREAM_BLOCK_SIZE)) > 0)
+    {
+        n_read += length;
+        ok = transcriber.push_audio(block.data(), length);
     }
+    ok = transcriber.finish() && ok;
 
-    return mono_audio;
+    std::cout << "Transcribed " << static_cast<double>(n_read) / SAMPLE_RATE
+              << " s of audio as it arrived: " << transcriber.n_frames()
+              << " frames, " << transcriber.n_notes() << " notes"
+              << std::endl;
+    return ok;
+}
+
+// samples fed to the live transcription at a time, about 46 ms
+constexpr int LIVE_BLOCK_SIZE = 1024;
+
+// Feed the audio to a LiveTranscriber in blocks, as if it came from a live
+// input, writing its messages to options.live_path
+static bool transcribe_live(const std::string &input_file,
+                            const CliOptions &options)
+{
+    std::unique_ptr<AudioStream> audio = open_audio(input_file, options);
+
+    // a reader closing the pipe is a write error rather than a signal
+    std::signal(SIGPIPE, SIG_IGN);
+    int fd = ::open(options.live_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                    0644);
+    if (fd < 0)
+    {
+        std::cerr << "Error: Unable to write " << options.live_path
+                  << std::endl;
+        return false;
+    }
+
+    basic_pitch::LiveTranscriber transcriber(
+        basic_pitch::live_message_writer(fd), options.config);
+    std::cout << "Streaming MIDI messages to: " << options.live_path
+              << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<float> block(LIVE_BLOCK_SIZE);
+    int64_t n_fed = 0;
+    bool ok = true;
+    int length;
+    while (ok && (length = audio->read(block.data(), LIVE_BLOCK_SIZE)) > 0)
+    {
+        n_fed += length;
+        if (options.realtime)
+        {
+            // the block is only complete once its last sample has played
+            std::this_thread::sleep_until(
+                start + std::chrono::duration<double>(
+                            static_cast<double>(n_fed) / SAMPLE_RATE));
+        }
+        ok = transcriber.push_audio(block.data(), length);
+    }
+    ok = transcriber.finish() && ok;
+    ::close(fd);
+
+    std::cout << "Live messages: " << transcriber.n_messages()
+              << ", latency mean " << transcriber.mean_latency_ms()
+              << " ms, max " << transcriber.max_latency_ms() << " ms"
+              << std::endl;
+    return ok;
 }
 
 int main(int argc, const char **argv)
 {
-    if (argc != 3)
+    CliOptions options;
+    basic_pitch::TranscriptionConfig &config = options.config;
+    std::vector<std::string> positional;
+
+    for (int i = 1; i < argc; ++i)
     {
-        std::cerr << "Usage: " << argv[0] << " <wav file> <out dir>"
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+
+        if (arg == "--onset-threshold" && has_value)
+        {
+            ok = parse_float(argv[++i], config.onset_threshold) &&
+                 config.onset_threshold >= 0.0f &&
+                 config.onset_threshold <= 1.0f;
+        }
+        else if (arg == "--frame-threshold" && has_value)
+        {
+            ok = parse_float(argv[++i], config.frame_threshold) &&
+                 config.frame_threshold >= 0.0f &&
+                 config.frame_threshold <= 1.0f;
+        }
+        else if (arg == "--min-note-len" && has_value)
+        {
+            ok = parse_int(argv[++i], config.min_note_len) &&
+                 config.min_note_len >= 0;
+        }
+        else if (arg == "--energy-tol" && has_value)
+        {
+            ok = parse_int(argv[++i], config.energy_tol) &&
+                 config.energy_tol > 0;
+        }
+        else if (arg == "--no-melodia")
+        {
+            config.use_melodia_trick = false;
+        }
+        else if (arg == "--no-pitch-bends")
+        {
+            config.include_pitch_bends = false;
+        }
+        else if (arg == "--thin-pitch-bends")
+        {
+            config.pitch_bend_tolerance =
+                std::max(config.pitch_bend_tolerance, 0);
+        }
+        else if (arg == "--pitch-bend-tolerance" && has_value)
+        {
+            ok = parse_int(argv[++i], config.pitch_bend_tolerance) &&
+                 config.pitch_bend_tolerance >= 0;
+        }
+        else if (arg == "--tempo" && has_value)
+        {
+            float bpm = 0.0f;
+            ok = parse_float(argv[++i], bpm);
+            config.midi_tempo_us = basic_pitch::tempo_bpm_to_us(bpm);
+            ok = ok && config.midi_tempo_us > 0;
+        }
+        else if (arg == "--program" && has_value)
+        {
+            ok = parse_int(argv[++i], config.midi_program) &&
+                 config.midi_program >= 0 && config.midi_program < 128;
+        }
+        else if (arg == "--min-pitch" && has_value)
+        {
+            ok = parse_int(argv[++i], config.pitch_range.min_pitch);
+        }
+        else if (arg == "--max-pitch" && has_value)
+        {
+            ok = parse_int(argv[++i], config.pitch_range.max_pitch);
+        }
+        else if (arg == "--start" && has_value)
+        {
+            ok = parse_float(argv[++i], options.start_time) &&
+                 options.start_time >= 0.0f;
+        }
+        else if (arg == "--end" && has_value)
+        {
+            ok = parse_float(argv[++i], options.end_time) &&
+                 options.end_time >= 0.0f;
+        }
+        else if (arg == "--benchmark")
+        {
+            options.benchmark = true;
+        }
+        else if (arg == "--benchmark-resampler")
+        {
+            options.benchmark_resampler = true;
+        }
+        else if (arg == "--resample-quality" && has_value)
+        {
+            ok = parse_resample_quality(argv[++i],
+                                        options.audio.resample_quality);
+        }
+        else if (arg == "--resample-threads" && has_value)
+        {
+            ok = parse_int(argv[++i], options.audio.resample_threads) &&
+                 options.audio.resample_threads >= 1;
+        }
+        else if (arg == "--channel-weights" && has_value)
+        {
+            ok = parse_weights(argv[++i], options.audio.channel_weights);
+        }
+        else if (arg == "--per-channel")
+        {
+            options.per_channel = true;
+        }
+        else if (arg == "--decode-threads" && has_value)
+        {
+            ok = parse_int(argv[++i], options.audio.decode_threads) &&
+                 options.audio.decode_threads >= 1;
+        }
+        else if (arg == "--raw" && has_value)
+        {
+            options.raw_format = argv[++i];
+            ok = options.raw_format == "s16" || options.raw_format == "f32";
+        }
+        else if (arg == "--raw-rate" && has_value)
+        {
+            ok = parse_int(argv[++i], options.raw_rate) &&
+                 options.raw_rate >= 1;
+        }
+        else if (arg == "--raw-channels" && has_value)
+        {
+            ok = parse_int(argv[++i], options.raw_channels) &&
+                 options.raw_channels >= 1;
+        }
+        else if (arg == "--save-posteriorgram")
+        {
+            options.save_posteriorgram = true;
+        }
+        else if (arg == "--save-npy")
+        {
+            options.save_npy = true;
+        }
+        else if (arg == "--from-posteriorgram")
+        {
+            options.from_posteriorgram = true;
+        }
+        else if (arg == "--precision" && has_value)
+        {
+            options.precision = argv[++i];
+            ok = options.precision == "float32" ||
+                 options.precision == "uint16" || options.precision == "uint8";
+        }
+        else if (arg == "--formats" && has_value)
+        {
+            ok = parse_formats(argv[++i], options.formats);
+        }
+        else if (arg == "--live" && has_value)
+        {
+            options.live_path = argv[++i];
+        }
+        else if (arg == "--realtime")
+        {
+            options.realtime = true;
+        }
+        else if (arg == "--sparse")
+        {
+            options.sparse = true;
+        }
+        else if (arg == "--sparse-floor" && has_value)
+        {
+            options.sparse = true;
+            ok = parse_float(argv[++i], options.sparse_floor) &&
+                 options.sparse_floor >= 0.0f;
+        }
+        else if (arg.starts_with("--"))
+        {
+            ok = false;
+        }
+        else
+        {
+            positional.push_back(arg);
+        }
+
+        if (!ok)
+        {
+            std::cerr << "Invalid option: " << arg << std::endl;
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (options.benchmark_resampler)
+    {
+        benchmark_resampler();
+        return 0;
+    }
+
+    bool live = !options.live_path.empty();
+    if (positional.size() != (live ? 1 : 2))
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    if ((options.precision != "float32" || options.sparse) &&
+        (options.save_posteriorgram || options.save_npy))
+    {
+        std::cerr << "Error: the posteriorgram can only be saved as float32"
+                  << std::endl;
+        exit(1);
+    }
+    if (!config.pitch_range.is_valid())
+    {
+        std::cerr << "Error: invalid pitch range "
+                  << config.pitch_range.min_pitch << "-"
+                  << config.pitch_range.max_pitch << std::endl;
+        exit(1);
+    }
+    if (!config.is_valid())
+    {
+        std::cerr << "Error: invalid transcription settings" << std::endl;
+        exit(1);
+    }
+    if (!config.pitch_range.is_full() && options.save_posteriorgram)
+    {
+        std::cerr << "Error: --save-posteriorgram needs the full pitch range"
+                  << std::endl;
+        exit(1);
+    }
+    if (options.precision != "float32" && options.sparse)
+    {
+        std::cerr << "Error: --sparse stores float32 values" << std::endl;
+        exit(1);
+    }
+    if (options.sparse && (options.sparse_floor > config.frame_threshold ||
+                           options.sparse_floor > config.onset_threshold))
+    {
+        std::cerr << "Warning: the sparse floor is above a threshold, notes "
+                     "will be missed"
+                  << std::endl;
+    }
+
+    const bool has_section =
+        options.start_time > 0.0f || options.end_time >= 0.0f;
+    if (options.end_time >= 0.0f && options.end_time <= options.start_time)
+    {
+        std::cerr << "Error: --end must be after --start" << std::endl;
+        exit(1);
+    }
+    if (has_section && (live || options.from_posteriorgram ||
+                        options.save_posteriorgram || options.save_npy))
+    {
+        std::cerr << "Error: --start and --end only apply to inference over "
+                     "the audio into notes"
+                  << std::endl;
+        exit(1);
+    }
+
+    const bool from_stdin = positional[0] == STDIO_PATH;
+    const bool to_stdout = !live && positional[1] == STDIO_PATH;
+    if (!from_stdin && !options.raw_format.empty())
+    {
+        std::cerr << "Error: --raw only applies to stdin" << std::endl;
+        exit(1);
+    }
+    if (options.raw_format.empty() &&
+        (options.raw_rate != SAMPLE_RATE || options.raw_channels != 1))
+    {
+        std::cerr << "Error: --raw-rate and --raw-channels need --raw"
+                  << std::endl;
+        exit(1);
+    }
+    if (from_stdin &&
+        (has_section || options.from_posteriorgram || options.sparse ||
+         options.precision != "float32" || options.save_posteriorgram ||
+         options.save_npy || options.benchmark ||
+         options.audio.resample_threads > 1))
+    {
+        std::cerr << "Error: stdin is transcribed as it arrives, without "
+                     "--start, --end,\n--resample-threads, --sparse, "
+                     "--precision, --benchmark or the posteriorgram options"
+                  << std::endl;
+        exit(1);
+    }
+    if (to_stdout && (options.formats.size() != 1 ||
+                      options.save_posteriorgram || options.save_npy))
+    {
+        std::cerr << "Error: stdout takes a single output format and no "
+                     "posteriorgram"
+                  << std::endl;
+        exit(1);
+    }
+
+    if (options.per_channel &&
+        (live || from_stdin || options.from_posteriorgram || options.sparse ||
+         options.save_posteriorgram || options.save_npy || options.benchmark ||
+         !options.audio.channel_weights.empty()))
+    {
+        std::cerr << "Error: --per-channel runs its own inference over the "
+                     "channels of a file,\nwithout --live, --sparse, "
+                     "--channel-weights, --benchmark or the\nposteriorgram "
+                     "options"
                   << std::endl;
         exit(1);
     }
+    if (options.per_channel && to_stdout && options.formats[0] != "mid")
+    {
+        std::cerr << "Error: --per-channel only writes MIDI to stdout"
+                  << std::endl;
+        exit(1);
+    }
+
+    if (live && (options.from_posteriorgram || options.sparse ||
+                 options.precision != "float32" ||
+                 options.save_posteriorgram || options.save_npy ||
+                 options.benchmark))
+    {
+        std::cerr << "Error: --live runs its own inference and writes no "
+                     "other outputs"
+                  << std::endl;
+        exit(1);
+    }
+
+    // the notes go to stdout, so the log goes to stderr
+    std::ostream stdout_stream(std::cout.rdbuf());
+    if (to_stdout)
+    {
+        std::cout.rdbuf(std::cerr.rdbuf());
+        // a reader closing the pipe is a write error rather than a signal
+        std::signal(SIGPIPE, SIG_IGN);
+    }
 
     std::cout << "basicpitch.cpp Main driver program" << std::endl;
     // load audio passed as argument
-    std::string wav_file = argv[1];
+    std::string wav_file = positional[0];
+
+    if (live)
+    {
+        return transcribe_live(wav_file, options) ? 0 : 1;
+    }
 
     // output dir passed as argument
-    std::string out_dir = argv[2];
+    std::string out_dir = positional[1];
 
     // Check if the output directory exists, and create it if not
     std::filesystem::path output_dir_path(out_dir);
-    if (!std::filesystem::exists(output_dir_path))
+    if (!to_stdout && !std::filesystem::exists(output_dir_path))
     {
         std::cerr << "Directory does not exist: " << out_dir << ". Creating it."
                   << std::endl;
@@ -154,7 +1122,7 @@ int main(int argc, const char **argv)
             return 1;
         }
     }
-    else if (!std::filesystem::is_directory(output_dir_path))
+    else if (!to_stdout && !std::filesystem::is_directory(output_dir_path))
     {
         std::cerr << "Error: " << out_dir << " exists but is not a directory!"
                   << std::endl;
@@ -163,38 +1131,246 @@ int main(int argc, const char **argv)
 
     std::cout << "Predicting MIDI for: " << wav_file << std::endl;
 
-    std::vector<float> audio = load_audio_file(wav_file);
+    // the notes of --start and --end, in frames of the whole input
+    int first_frame = 0;
+    int end_frame = std::numeric_limits<int>::max();
+    const basic_pitch::ModelSection &section = options.section;
+    if (has_section)
+    {
+        first_frame = basic_pitch::first_frame_at_or_after(options.start_time);
+        if (options.end_time >= 0.0f)
+        {
+            end_frame = basic_pitch::first_frame_at_or_after(options.end_time);
+        }
+        // only the model windows for the frames around them are run
+        if (options.end_time >= 0.0f)
+        {
+            options.section = basic_pitch::model_section(
+                std::max(first_frame - SECTION_CONTEXT_FRAMES, 0),
+                end_frame + SECTION_CONTEXT_FRAMES);
+            options.audio.end_sample = section.end_sample;
+        }
+        else
+        {
+            // up to the end of the input
+            options.section = basic_pitch::model_section(
+                std::max(first_frame - SECTION_CONTEXT_FRAMES, 0),
+                first_frame + 1);
+            options.section.end_frame = std::numeric_limits<int>::max();
+        }
+        options.audio.first_sample = section.first_sample;
 
-    auto inference_result = basic_pitch::ort_inference(audio);
+        std::cout << "Notes starting from " << options.start_time << " s to ";
+        if (options.end_time >= 0.0f)
+        {
+            std::cout << options.end_time << " s";
+        }
+        else
+        {
+            std::cout << "the end";
+        }
+        std::cout << ", reading the audio from "
+                  << static_cast<double>(section.first_sample) / SAMPLE_RATE
+                  << " s" << std::endl;
+    }
+
+    // with --per-channel the channels are opened up front: the notes of
+    // each go to files of their own and to a track of their own in the
+    // MIDI file
+    std::vector<std::unique_ptr<AudioStream>> channels;
+    if (options.per_channel)
+    {
+        channels = open_channels(wav_file, options.audio);
+    }
+    const int n_note_outputs =
+        options.per_channel ? static_cast<int>(channels.size()) : 1;
+    if (n_note_outputs > basic_pitch::MAX_MIDI_TRACKS &&
+        std::ranges::find(options.formats, "mid") != options.formats.end())
+    {
+        std::cerr << "Error: a MIDI file holds at most "
+                  << basic_pitch::MAX_MIDI_TRACKS << " channel tracks"
+                  << std::endl;
+        return 1;
+    }
+
+    // output files are named after the input file
+    std::filesystem::path output_stem =
+        output_dir_path /
+        (from_stdin ? std::filesystem::path("stdin")
+                    : std::filesystem::path(wav_file).stem());
 
-    Eigen::Tensor2dXf unwrapped_notes = inference_result.notes;
-    Eigen::Tensor2dXf unwrapped_onsets = inference_result.onsets;
-    Eigen::Tensor2dXf unwrapped_contours = inference_result.contours;
+    // one file per output format, named after the input file, or stdout;
+    // with --per-channel, one per channel but for MIDI
+    std::vector<std::filesystem::path> output_files;
+    int midi_fd = -1;
+    std::vector<std::unique_ptr<std::ofstream>> streams;
+    std::vector<std::unique_ptr<basic_pitch::NoteSink>> sinks;
+    // the channel of each sink, -1 for all of them
+    std::vector<int> sink_channels;
+    for (const std::string &format : options.formats)
+    {
+        if (format == "mid")
+        {
+            std::filesystem::path output_file = output_stem;
+            output_file += OUTPUT_FORMATS.at(format);
+            if (!to_stdout)
+            {
+                output_files.push_back(output_file);
+            }
 
-    // Call the function to convert the output to MIDI
-    std::vector<uint8_t> midiBytes =
-        basic_pitch::convert_to_midi(inference_result);
+            // the MIDI file is streamed out as the notes are converted
+            midi_fd = to_stdout ? STDOUT_FILENO
+                                : ::open(output_file.c_str(),
+                                         O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (midi_fd < 0)
+            {
+                std::cerr << "Error: Unable to write " << output_file
+                          << std::endl;
+                return 1;
+            }
+            sinks.push_back(std::make_unique<basic_pitch::MidiStreamWriter>(
+                midi_fd, config, n_note_outputs));
+            sink_channels.push_back(-1);
+            continue;
+        }
 
-    // Log the size of the MIDI data
-    std::ostringstream log_message;
-    log_message << "MIDI data size: " << midiBytes.size();
+        for (int c = 0; c < n_note_outputs; ++c)
+        {
+            std::filesystem::path output_file = output_stem;
+            if (options.per_channel)
+            {
+                output_file += ".ch" + std::to_string(c + 1);
+            }
+            output_file += OUTPUT_FORMATS.at(format);
 
-    std::cout << log_message.str() << std::endl;
+            std::ostream *out = &stdout_stream;
+            if (!to_stdout)
+            {
+                output_files.push_back(output_file);
+                streams.push_back(std::make_unique<std::ofstream>(
+                    output_file, format == "bin" || format == "idx"
+                                     ? std::ios::binary
+                                     : std::ios::out));
+                if (!*streams.back())
+                {
+                    std::cerr << "Error: Unable to write " << output_file
+                              << std::endl;
+                    return 1;
+                }
+                out = streams.back().get();
+            }
+            if (format == "csv")
+            {
+                sinks.push_back(
+                    std::make_unique<basic_pitch::CsvNoteWriter>(*out));
+            }
+            else if (format == "json")
+            {
+                sinks.push_back(
+                    std::make_unique<basic_pitch::JsonNoteWriter>(*out));
+            }
+            else if (format == "idx")
+            {
+                sinks.push_back(
+                    std::make_unique<basic_pitch::NoteIndexWriter>(*out));
+            }
+            else
+            {
+                sinks.push_back(
+                    std::make_unique<basic_pitch::BinaryNoteWriter>(*out));
+            }
+            sink_channels.push_back(c);
+        }
+    }
 
-    // write the midiBytes to a file 'output.mid' in the output directory
-    // we dont need to use libremidi itself since the bytes are already correct
-    // just write the bytes to a file
+    // the MIDI writer ends a track each time a channel finishes it
+    std::vector<std::vector<basic_pitch::NoteSink *>> channel_sinks(
+        n_note_outputs);
+    std::vector<std::unique_ptr<SectionNoteSink>> section_sinks;
+    for (std::size_t i = 0; i < sinks.size(); ++i)
+    {
+        for (int c = 0; c < n_note_outputs; ++c)
+        {
+            if (sink_channels[i] >= 0 && sink_channels[i] != c)
+            {
+                continue;
+            }
+            if (has_section)
+            {
+                section_sinks.push_back(std::make_unique<SectionNoteSink>(
+                    *sinks[i], section.frame_offset, first_frame, end_frame));
+                channel_sinks[c].push_back(section_sinks.back().get());
+                continue;
+            }
+            channel_sinks[c].push_back(sinks[i].get());
+        }
+    }
+    const std::vector<basic_pitch::NoteSink *> &sink_ptrs = channel_sinks[0];
 
-    // Generate MIDI output file name with .mid extension
-    std::filesystem::path midi_file =
-        output_dir_path / std::filesystem::path(wav_file).filename();
-    midi_file.replace_extension(".mid");
+    bool ok;
+    if (from_stdin)
+    {
+        ok = transcribe_stream(wav_file, options, sink_ptrs);
+    }
+    else if (options.per_channel && options.precision == "uint16")
+    {
+        ok = transcribe_channels<uint16_t>(channels, options, channel_sinks);
+    }
+    else if (options.per_channel && options.precision == "uint8")
+    {
+        ok = transcribe_channels<uint8_t>(channels, options, channel_sinks);
+    }
+    else if (options.per_channel)
+    {
+        ok = transcribe_channels<float>(channels, options, channel_sinks);
+    }
+    else if (options.sparse)
+    {
+        ok = transcribe_sparse(wav_file, options, sink_ptrs);
+    }
+    else if (options.precision == "uint16")
+    {
+        ok = transcribe<uint16_t>(wav_file, output_stem, options, sink_ptrs);
+    }
+    else if (options.precision == "uint8")
+    {
+        ok = transcribe<uint8_t>(wav_file, output_stem, options, sink_ptrs);
+    }
+    else
+    {
+        ok = transcribe<float>(wav_file, output_stem, options, sink_ptrs);
+    }
 
-    std::ofstream midi_stream(midi_file, std::ios::binary);
-    midi_stream.write(reinterpret_cast<const char *>(midiBytes.data()),
-                      midiBytes.size());
+    section_sinks.clear();
+    sinks.clear();
+    streams.clear();
+    if (to_stdout)
+    {
+        ok = stdout_stream.flush() && ok;
+    }
+    else if (midi_fd >= 0)
+    {
+        ::close(midi_fd);
+    }
+    if (!ok)
+    {
+        for (const auto &output_file : output_files)
+        {
+            std::filesystem::remove(output_file);
+        }
+        return 1;
+    }
 
-    std::cout << "Wrote MIDI file to: " << midi_file << std::endl;
+    for (const auto &output_file : output_files)
+    {
+        std::cout << "Wrote " << std::filesystem::file_size(output_file)
+                  << " bytes to: " << output_file << std::endl;
+    }
+    if (to_stdout)
+    {
+        std::cout << "Wrote " << options.formats[0] << " to stdout"
+                  << std::endl;
+    }
 
     return 0;
 }
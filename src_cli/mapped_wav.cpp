@@ -0,0 +1,185 @@
+#include "mapped_wav.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// float samples are copied as they are in the file
+static_assert(std::endian::native == std::endian::little,
+              "the WAV reader assumes a little-endian host");
+
+namespace
+{
+constexpr uint16_t WAVE_FORMAT_PCM = 1;
+constexpr uint16_t WAVE_FORMAT_IEEE_FLOAT = 3;
+constexpr uint16_t WAVE_FORMAT_EXTENSIBLE = 0xfffe;
+
+uint16_t read_u16(const uint8_t *p)
+{
+    return static_cast<uint16_t>(p[0] | p[1] << 8);
+}
+
+uint32_t read_u32(const uint8_t *p)
+{
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 |
+           static_cast<uint32_t>(p[3]) << 24;
+}
+} // namespace
+
+bool parse_wav_format(const uint8_t *chunk, std::size_t size,
+                      WavFormat &format)
+{
+    if (size < 16)
+    {
+        return false;
+    }
+    uint16_t format_tag = read_u16(chunk);
+    format.n_channels = read_u16(chunk + 2);
+    format.sample_rate = static_cast<int>(read_u32(chunk + 4));
+    format.frame_size = read_u16(chunk + 12);
+    format.bits_per_sample = read_u16(chunk + 14);
+    if (format_tag == WAVE_FORMAT_EXTENSIBLE && size >= 40)
+    {
+        // the format is the start of the sub-format GUID
+        format_tag = read_u16(chunk + 24);
+    }
+
+    if (format_tag == WAVE_FORMAT_PCM && format.bits_per_sample == 16)
+    {
+        format.sample_format = WavSampleFormat::Int16;
+    }
+    else if (format_tag == WAVE_FORMAT_PCM && format.bits_per_sample == 24)
+    {
+        format.sample_format = WavSampleFormat::Int24;
+    }
+    else if (format_tag == WAVE_FORMAT_IEEE_FLOAT &&
+             format.bits_per_sample == 32)
+    {
+        format.sample_format = WavSampleFormat::Float32;
+    }
+    else
+    {
+        return false;
+    }
+    return format.n_channels >= 1 && format.sample_rate >= 1 &&
+           format.frame_size == static_cast<std::size_t>(format.n_channels) *
+                                    (format.bits_per_sample / 8);
+}
+
+void convert_wav_samples(WavSampleFormat sample_format, const uint8_t *data,
+                         std::size_t n, float *out)
+{
+    const uint8_t *p = data;
+    switch (sample_format)
+    {
+    case WavSampleFormat::Int16:
+        for (std::size_t i = 0; i < n; ++i, p += 2)
+        {
+            out[i] = static_cast<int16_t>(read_u16(p)) * (1.0f / 32768.0f);
+        }
+        break;
+    case WavSampleFormat::Int24:
+        for (std::size_t i = 0; i < n; ++i, p += 3)
+        {
+            // the sign is shifted in from the top byte
+            const int32_t sample = static_cast<int32_t>(
+                static_cast<uint32_t>(p[0]) << 8 |
+                static_cast<uint32_t>(p[1]) << 16 |
+                static_cast<uint32_t>(p[2]) << 24);
+            out[i] = (sample >> 8) * (1.0f / 8388608.0f);
+        }
+        break;
+    case WavSampleFormat::Float32:
+        std::memcpy(out, p, n * sizeof(float));
+        break;
+    }
+}
+
+std::unique_ptr<MappedWav> MappedWav::open(const std::string &filename)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size < 12)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+    const std::size_t size = static_cast<std::size_t>(st.st_size);
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file open
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    std::unique_ptr<MappedWav> wav(new MappedWav());
+    wav->map_ = map;
+    wav->map_size_ = size;
+
+    const uint8_t *bytes = static_cast<const uint8_t *>(map);
+    if (std::memcmp(bytes, "RIFF", 4) != 0 ||
+        std::memcmp(bytes + 8, "WAVE", 4) != 0)
+    {
+        return nullptr;
+    }
+
+    // walk the chunks for the format and the samples
+    bool has_format = false;
+    std::size_t data_offset = 0;
+    std::size_t data_size = 0;
+    std::size_t pos = 12;
+    while (pos + 8 <= size && data_offset == 0)
+    {
+        const uint8_t *chunk = bytes + pos;
+        std::size_t chunk_size = read_u32(chunk + 4);
+        if (std::memcmp(chunk, "fmt ", 4) == 0 &&
+            pos + 8 + chunk_size <= size)
+        {
+            has_format = parse_wav_format(chunk + 8, chunk_size, wav->format_);
+        }
+        else if (std::memcmp(chunk, "data", 4) == 0)
+        {
+            data_offset = pos + 8;
+            // files written while streaming can leave the size unset
+            data_size = std::min(chunk_size, size - data_offset);
+        }
+        // chunks are padded to an even size
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    if (!has_format || data_offset == 0)
+    {
+        return nullptr;
+    }
+
+    wav->data_ = bytes + data_offset;
+    wav->n_frames_ = data_size / wav->format_.frame_size;
+    // the samples are read front to back
+    ::madvise(map, size, MADV_SEQUENTIAL);
+    return wav;
+}
+
+MappedWav::~MappedWav()
+{
+    if (map_ != nullptr)
+    {
+        ::munmap(map_, map_size_);
+    }
+}
+
+void MappedWav::read_frames(std::size_t first, std::size_t n,
+                            float *out) const
+{
+    convert_wav_samples(format_.sample_format,
+                        data_ + first * format_.frame_size,
+                        n * format_.n_channels, out);
+}
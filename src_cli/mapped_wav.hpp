@@ -0,0 +1,73 @@
+#ifndef MAPPED_WAV_HPP
+#define MAPPED_WAV_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// The WAV sample formats read without decoding: 16-bit or 24-bit PCM, or
+// 32-bit float
+enum class WavSampleFormat
+{
+    Int16,
+    Int24,
+    Float32,
+};
+
+// The fmt chunk of a WAV file in one of those formats
+struct WavFormat
+{
+    WavSampleFormat sample_format = WavSampleFormat::Int16;
+    int n_channels = 0;
+    int sample_rate = 0;
+    int bits_per_sample = 0;
+    std::size_t frame_size = 0;
+};
+
+// Parse the `size` bytes of a fmt chunk after its header; false if the
+// samples are not in one of the formats above
+bool parse_wav_format(const uint8_t *chunk, std::size_t size,
+                      WavFormat &format);
+
+// Convert n little-endian samples to floats in [-1, 1)
+void convert_wav_samples(WavSampleFormat sample_format, const uint8_t *data,
+                         std::size_t n, float *out);
+
+// A WAV file in one of the formats above mapped into memory. Frames are
+// converted to float as they are read, so the file is never decoded into a
+// buffer of its own and reading can start right away.
+class MappedWav
+{
+  public:
+    // Map the file; null if it is not a WAV file in one of the formats
+    // above, for the caller to decode some other way
+    static std::unique_ptr<MappedWav> open(const std::string &filename);
+    ~MappedWav();
+
+    MappedWav(const MappedWav &) = delete;
+    MappedWav &operator=(const MappedWav &) = delete;
+
+    int n_channels() const { return format_.n_channels; }
+    int sample_rate() const { return format_.sample_rate; }
+    int bits_per_sample() const { return format_.bits_per_sample; }
+    bool is_float() const
+    {
+        return format_.sample_format == WavSampleFormat::Float32;
+    }
+    std::size_t n_frames() const { return n_frames_; }
+
+    // Convert n frames from `first` to interleaved floats in [-1, 1)
+    void read_frames(std::size_t first, std::size_t n, float *out) const;
+
+  private:
+    MappedWav() = default;
+
+    void *map_ = nullptr;
+    std::size_t map_size_ = 0;
+    const uint8_t *data_ = nullptr;
+    WavFormat format_;
+    std::size_t n_frames_ = 0;
+};
+
+#endif // MAPPED_WAV_HPP
@@ -0,0 +1,293 @@
+#include "parallel_flac.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <libnyquist/Decoders.h>
+#include <optional>
+#include <vector>
+
+namespace
+{
+constexpr uint8_t METADATA_STREAMINFO = 0;
+constexpr std::size_t STREAMINFO_SIZE = 34;
+
+// runs shorter than this are not worth a thread of their own
+constexpr std::size_t MIN_RUN_BYTES = 1 << 20;
+
+struct StreamInfo
+{
+    int min_block_size = 0;
+    int max_block_size = 0;
+    int sample_rate = 0;
+    int n_channels = 0;
+    uint64_t n_samples = 0;
+    // the block as it is in the file
+    const uint8_t *block = nullptr;
+};
+
+StreamInfo parse_stream_info(const uint8_t *d)
+{
+    StreamInfo info;
+    info.min_block_size = d[0] << 8 | d[1];
+    info.max_block_size = d[2] << 8 | d[3];
+    info.sample_rate = d[10] << 12 | d[11] << 4 | d[12] >> 4;
+    info.n_channels = ((d[12] >> 1) & 7) + 1;
+    info.n_samples = static_cast<uint64_t>(d[13] & 15) << 32 |
+                     static_cast<uint64_t>(d[14]) << 24 |
+                     static_cast<uint64_t>(d[15]) << 16 |
+                     static_cast<uint64_t>(d[16]) << 8 | d[17];
+    info.block = d;
+    return info;
+}
+
+// CRC-8 of the frame headers, polynomial x^8 + x^2 + x + 1
+uint8_t crc8(const uint8_t *data, std::size_t size)
+{
+    uint8_t crc = 0;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = static_cast<uint8_t>((crc & 0x80) ? (crc << 1) ^ 0x07
+                                                    : crc << 1);
+        }
+    }
+    return crc;
+}
+
+// The first sample of the frame if a header of this stream starts at `p`,
+// with the blocking strategy it was written with. Audio data can look like
+// a sync code, so the whole header is checked down to its CRC.
+std::optional<uint64_t> frame_first_sample(const uint8_t *p,
+                                           const uint8_t *end,
+                                           const StreamInfo &info,
+                                           bool &variable_block_size)
+{
+    // sync code, reserved bit, blocking strategy, then the fixed fields
+    if (end - p < 6 || p[0] != 0xff || (p[1] & 0xfe) != 0xf8)
+    {
+        return std::nullopt;
+    }
+    variable_block_size = p[1] & 1;
+    const int block_size_code = p[2] >> 4;
+    const int sample_rate_code = p[2] & 15;
+    const int channel_code = p[3] >> 4;
+    const int sample_size_code = (p[3] >> 1) & 7;
+    const int n_channels = channel_code < 8 ? channel_code + 1 : 2;
+    if (block_size_code == 0 || sample_rate_code == 15 || channel_code > 10 ||
+        sample_size_code == 3 || (p[3] & 1) != 0 ||
+        n_channels != info.n_channels)
+    {
+        return std::nullopt;
+    }
+
+    // frame or sample number, coded like UTF-8 in up to 7 bytes
+    const uint8_t *q = p + 4;
+    int n_extra = 0;
+    uint64_t number = *q;
+    if (*q >= 0x80)
+    {
+        while (n_extra < 7 && (*q << (n_extra + 1) & 0x80) != 0)
+        {
+            n_extra++;
+        }
+        if (n_extra == 0 || n_extra > 6)
+        {
+            return std::nullopt;
+        }
+        number = *q & (0x7f >> (n_extra + 1));
+    }
+    q++;
+    for (int i = 0; i < n_extra; ++i, ++q)
+    {
+        if (q == end || (*q & 0xc0) != 0x80)
+        {
+            return std::nullopt;
+        }
+        number = number << 6 | (*q & 0x3f);
+    }
+
+    // block size and sample rate stored after the number
+    q += block_size_code == 6 ? 1 : block_size_code == 7 ? 2 : 0;
+    q += sample_rate_code == 12 ? 1 : sample_rate_code >= 13 ? 2 : 0;
+    if (q >= end || crc8(p, q - p) != *q)
+    {
+        return std::nullopt;
+    }
+
+    if (variable_block_size)
+    {
+        return number;
+    }
+    // every block but the last has the one block size
+    if (info.min_block_size != info.max_block_size)
+    {
+        return std::nullopt;
+    }
+    return number * info.max_block_size;
+}
+
+// A run of frames [begin, end) of the file holding samples [first_sample,
+// end_sample)
+struct FrameRun
+{
+    std::size_t begin;
+    std::size_t end;
+    uint64_t first_sample;
+    uint64_t end_sample;
+};
+
+// Decode a run as a stream of its own into samples [first_sample,
+// end_sample) of `out`
+bool decode_run(const std::vector<uint8_t> &file, const StreamInfo &info,
+                const FrameRun &run, float *out)
+{
+    // "fLaC", then the STREAMINFO as the last metadata block, with the
+    // length of the run and no MD5 signature
+    std::vector<uint8_t> stream = {'f', 'L', 'a', 'C', 0x80, 0, 0,
+                                   STREAMINFO_SIZE};
+    stream.insert(stream.end(), info.block, info.block + STREAMINFO_SIZE);
+    uint8_t *block = stream.data() + 8;
+    const uint64_t n_samples = run.end_sample - run.first_sample;
+    block[13] = static_cast<uint8_t>((block[13] & 0xf0) | n_samples >> 32);
+    for (int i = 0; i < 4; ++i)
+    {
+        block[14 + i] = static_cast<uint8_t>(n_samples >> (24 - 8 * i));
+    }
+    std::fill(block + 18, block + STREAMINFO_SIZE, 0);
+    stream.insert(stream.end(), file.begin() + run.begin,
+                  file.begin() + run.end);
+
+    nqr::AudioData data;
+    try
+    {
+        nqr::NyquistIO loader;
+        loader.Load(&data, "flac", stream);
+    }
+    catch (const std::exception &)
+    {
+        // the whole file is decoded again by the caller
+        return false;
+    }
+    if (data.channelCount != info.n_channels ||
+        data.samples.size() != n_samples * info.n_channels)
+    {
+        return false;
+    }
+    std::copy(data.samples.begin(), data.samples.end(),
+              out + run.first_sample * info.n_channels);
+    return true;
+}
+} // namespace
+
+bool decode_flac_parallel(const std::string &filename, int n_threads,
+                          nqr::AudioData &decoded)
+{
+    std::ifstream in(filename, std::ios::binary);
+    std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)),
+                              std::istreambuf_iterator<char>());
+    if (file.size() < 8 || std::memcmp(file.data(), "fLaC", 4) != 0)
+    {
+        return false;
+    }
+
+    // the metadata blocks up to the first frame
+    std::optional<StreamInfo> info;
+    std::size_t pos = 4;
+    bool last_block = false;
+    while (!last_block)
+    {
+        if (pos + 4 > file.size())
+        {
+            return false;
+        }
+        last_block = file[pos] & 0x80;
+        const int type = file[pos] & 0x7f;
+        const std::size_t size = static_cast<std::size_t>(
+            file[pos + 1] << 16 | file[pos + 2] << 8 | file[pos + 3]);
+        pos += 4;
+        if (pos + size > file.size())
+        {
+            return false;
+        }
+        if (type == METADATA_STREAMINFO && size == STREAMINFO_SIZE)
+        {
+            info = parse_stream_info(file.data() + pos);
+        }
+        pos += size;
+    }
+    // the length is needed to place the last run
+    if (!info || info->n_samples == 0)
+    {
+        return false;
+    }
+
+    const uint8_t *end = file.data() + file.size();
+    bool variable_block_size = false;
+    if (frame_first_sample(file.data() + pos, end, *info,
+                           variable_block_size) != uint64_t(0))
+    {
+        return false;
+    }
+
+    // cut at the first frame header past each even share of the frames
+    const std::size_t frames_size = file.size() - pos;
+    const int n_runs = static_cast<int>(std::min<std::size_t>(
+        n_threads, frames_size / MIN_RUN_BYTES));
+    std::vector<FrameRun> runs = {{pos, file.size(), 0, info->n_samples}};
+    for (int k = 1; k < n_runs; ++k)
+    {
+        for (std::size_t p = std::max(pos + frames_size * k / n_runs,
+                                      runs.back().begin + 1);
+             p < file.size(); ++p)
+        {
+            bool variable = false;
+            std::optional<uint64_t> first_sample =
+                frame_first_sample(file.data() + p, end, *info, variable);
+            if (first_sample && variable == variable_block_size &&
+                *first_sample > runs.back().first_sample &&
+                *first_sample < info->n_samples)
+            {
+                runs.back().end = p;
+                runs.back().end_sample = *first_sample;
+                runs.push_back({p, file.size(), *first_sample,
+                                info->n_samples});
+                break;
+            }
+        }
+    }
+    if (runs.size() < 2)
+    {
+        return false;
+    }
+
+    std::vector<float> samples(info->n_samples * info->n_channels);
+    std::vector<std::future<bool>> results;
+    for (const FrameRun &run : runs)
+    {
+        results.push_back(std::async(
+            std::launch::async, [&file, &info, &samples, run]
+            { return decode_run(file, *info, run, samples.data()); }));
+    }
+    bool ok = true;
+    for (std::future<bool> &result : results)
+    {
+        ok = result.get() && ok;
+    }
+    if (!ok)
+    {
+        return false;
+    }
+
+    decoded.channelCount = info->n_channels;
+    decoded.sampleRate = info->sample_rate;
+    decoded.lengthSeconds =
+        static_cast<double>(info->n_samples) / info->sample_rate;
+    decoded.samples = std::move(samples);
+    return true;
+}
@@ -0,0 +1,18 @@
+#ifndef PARALLEL_FLAC_HPP
+#define PARALLEL_FLAC_HPP
+
+#include <libnyquist/Common.h>
+#include <string>
+
+// Decode a FLAC file on up to n_threads threads. FLAC frames are decoded
+// independently of each other, so the frames are split into one run per
+// thread at the frame headers found past even offsets of the file. Each
+// run is decoded by libnyquist as a stream of its own behind a copy of the
+// file's STREAMINFO, then copied into its place in one output buffer, as
+// the frame headers give the first sample of every run. False if the file
+// is not FLAC, is too short to split or a run does not decode to the
+// expected samples, for the caller to decode the file whole.
+bool decode_flac_parallel(const std::string &filename, int n_threads,
+                          nqr::AudioData &decoded);
+
+#endif // PARALLEL_FLAC_HPP
@@ -0,0 +1,155 @@
+#include "pipe_audio.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+namespace
+{
+// the largest chunk before the samples read into memory, far more than a
+// fmt chunk or the usual metadata needs
+constexpr std::size_t HEADER_CHUNK_LIMIT = 64 * 1024;
+
+uint32_t read_u32(const uint8_t *p)
+{
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 |
+           static_cast<uint32_t>(p[3]) << 24;
+}
+
+int sample_bits(WavSampleFormat sample_format)
+{
+    switch (sample_format)
+    {
+    case WavSampleFormat::Int16:
+        return 16;
+    case WavSampleFormat::Int24:
+        return 24;
+    case WavSampleFormat::Float32:
+        return 32;
+    }
+    return 0;
+}
+} // namespace
+
+std::unique_ptr<PipeAudio> PipeAudio::open_raw(int fd,
+                                               WavSampleFormat sample_format,
+                                               int sample_rate, int n_channels)
+{
+    if (sample_rate < 1 || n_channels < 1)
+    {
+        return nullptr;
+    }
+    std::unique_ptr<PipeAudio> audio(new PipeAudio());
+    audio->fd_ = fd;
+    audio->format_.sample_format = sample_format;
+    audio->format_.n_channels = n_channels;
+    audio->format_.sample_rate = sample_rate;
+    audio->format_.bits_per_sample = sample_bits(sample_format);
+    audio->format_.frame_size =
+        static_cast<std::size_t>(n_channels) *
+        (audio->format_.bits_per_sample / 8);
+    return audio;
+}
+
+std::unique_ptr<PipeAudio> PipeAudio::open_wav(int fd)
+{
+    std::unique_ptr<PipeAudio> audio(new PipeAudio());
+    audio->fd_ = fd;
+
+    uint8_t header[12];
+    if (audio->read_bytes(header, sizeof(header)) != sizeof(header) ||
+        std::memcmp(header, "RIFF", 4) != 0 ||
+        std::memcmp(header + 8, "WAVE", 4) != 0)
+    {
+        return nullptr;
+    }
+
+    // the chunks are read in order up to the samples, which come last
+    bool has_format = false;
+    std::vector<uint8_t> chunk;
+    while (true)
+    {
+        uint8_t chunk_header[8];
+        if (audio->read_bytes(chunk_header, sizeof(chunk_header)) !=
+            sizeof(chunk_header))
+        {
+            return nullptr;
+        }
+        const uint32_t chunk_size = read_u32(chunk_header + 4);
+        if (std::memcmp(chunk_header, "data", 4) == 0)
+        {
+            // a writer that cannot seek back leaves the size unset
+            if (chunk_size != 0 && chunk_size != UINT32_MAX)
+            {
+                audio->n_bytes_left_ = chunk_size;
+            }
+            break;
+        }
+
+        // chunks are padded to an even size
+        const std::size_t padded_size = chunk_size + (chunk_size & 1);
+        if (padded_size > HEADER_CHUNK_LIMIT)
+        {
+            return nullptr;
+        }
+        chunk.resize(padded_size);
+        if (audio->read_bytes(chunk.data(), padded_size) != padded_size)
+        {
+            return nullptr;
+        }
+        if (std::memcmp(chunk_header, "fmt ", 4) == 0)
+        {
+            has_format =
+                parse_wav_format(chunk.data(), chunk_size, audio->format_);
+        }
+    }
+
+    if (!has_format)
+    {
+        return nullptr;
+    }
+    return audio;
+}
+
+std::size_t PipeAudio::read_frames(std::size_t n, float *out)
+{
+    const std::size_t size = static_cast<std::size_t>(
+        std::min<uint64_t>(n * format_.frame_size, n_bytes_left_));
+    bytes_.resize(size);
+    const std::size_t n_read = read_bytes(bytes_.data(), size);
+    n_bytes_left_ -= n_read;
+
+    // a partial frame at the end of the stream is dropped
+    const std::size_t n_frames = n_read / format_.frame_size;
+    convert_wav_samples(format_.sample_format, bytes_.data(),
+                        n_frames * format_.n_channels, out);
+    return n_frames;
+}
+
+std::size_t PipeAudio::read_bytes(uint8_t *data, std::size_t size)
+{
+    std::size_t n_read = 0;
+    while (n_read < size)
+    {
+        ssize_t result = ::read(fd_, data + n_read, size - n_read);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result < 0)
+        {
+            std::cerr << "[ERROR] unable to read the audio input: "
+                      << std::strerror(errno) << std::endl;
+            exit(1);
+        }
+        if (result == 0)
+        {
+            break;
+        }
+        n_read += static_cast<std::size_t>(result);
+    }
+    return n_read;
+}
@@ -0,0 +1,57 @@
+#ifndef PIPE_AUDIO_HPP
+#define PIPE_AUDIO_HPP
+
+#include "mapped_wav.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Audio read front to back from a file descriptor such as stdin: raw
+// interleaved samples in a given format, or a WAV stream in one of the
+// formats of MappedWav. The length need not be known up front; frames are
+// converted to float a block at a time as they are read, so the stream is
+// never held whole.
+class PipeAudio
+{
+  public:
+    // Raw little-endian samples; only the WAV sample formats are read
+    static std::unique_ptr<PipeAudio> open_raw(int fd,
+                                               WavSampleFormat sample_format,
+                                               int sample_rate,
+                                               int n_channels);
+
+    // Read the header of a WAV stream up to its samples; null if it is not
+    // a WAV stream in one of the formats of MappedWav
+    static std::unique_ptr<PipeAudio> open_wav(int fd);
+
+    PipeAudio(const PipeAudio &) = delete;
+    PipeAudio &operator=(const PipeAudio &) = delete;
+
+    int n_channels() const { return format_.n_channels; }
+    int sample_rate() const { return format_.sample_rate; }
+    int bits_per_sample() const { return format_.bits_per_sample; }
+    bool is_float() const
+    {
+        return format_.sample_format == WavSampleFormat::Float32;
+    }
+
+    // Convert up to n of the next frames to interleaved floats in [-1, 1);
+    // returns how many, fewer only at the end of the stream and 0 after it
+    std::size_t read_frames(std::size_t n, float *out);
+
+  private:
+    PipeAudio() = default;
+
+    // read up to `size` bytes, fewer only at the end of the stream or on an
+    // error; returns how many
+    std::size_t read_bytes(uint8_t *data, std::size_t size);
+
+    int fd_ = -1;
+    WavFormat format_;
+    // bytes of samples left in the stream, the most for an unknown length
+    uint64_t n_bytes_left_ = UINT64_MAX;
+    std::vector<uint8_t> bytes_;
+};
+
+#endif // PIPE_AUDIO_HPP
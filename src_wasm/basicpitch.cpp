@@ -3,8 +3,6 @@
 #include <cstdlib>
 #include <emscripten.h>
 #include <iostream>
-#include <libremidi/libremidi.hpp>
-#include <libremidi/writer.hpp>
 #include <map>
 #include <numeric>
 #include <ranges>
@@ -21,30 +19,56 @@ extern "C"
     EM_JS(void, callWriteWasmLog, (const char *str),
           {console.log(UTF8ToString(str))});
 
+    // Same as convertToMidi, with the post-processing settings of
+    // basic_pitch::TranscriptionConfig passed in from JavaScript
     EMSCRIPTEN_KEEPALIVE
-    void convertToMidi(const float *mono_audio, int length,
-                       uint8_t **midi_data_ptr, int *midi_size)
+    void convertToMidiWithConfig(const float *mono_audio, int length,
+                                 float onset_threshold, float frame_threshold,
+                                 int min_note_len, int energy_tol,
+                                 int use_melodia_trick,
+                                 int include_pitch_bends, float tempo_bpm,
+                                 int midi_program, uint8_t **midi_data_ptr,
+                                 int *midi_size)
     {
+        basic_pitch::TranscriptionConfig config;
+        config.onset_threshold = onset_threshold;
+        config.frame_threshold = frame_threshold;
+        config.min_note_len = min_note_len;
+        config.energy_tol = energy_tol;
+        config.use_melodia_trick = use_melodia_trick != 0;
+        config.include_pitch_bends = include_pitch_bends != 0;
+        config.midi_tempo_us = basic_pitch::tempo_bpm_to_us(tempo_bpm);
+        config.midi_program = midi_program;
+
+        if (!config.is_valid())
+        {
+            callWriteWasmLog("Invalid transcription settings.");
+
+            *midi_data_ptr = nullptr;
+            *midi_size = 0;
+            return;
+        }
+
         callWriteWasmLog("Starting inference...");
 
         auto inference_result = basic_pitch::ort_inference(mono_audio, length);
 
         callWriteWasmLog("Inference finished. Now generating MIDI file...");
 
-        // Call the function to convert the output to MIDI
-        std::vector<uint8_t> midiBytes =
-            basic_pitch::convert_to_midi(inference_result);
-
-        callWriteWasmLog("MIDI file generated. Now saving to blob...");
-
-        // Log the size of the MIDI data
-        std::ostringstream log_message;
-        log_message << "MIDI data size: " << midiBytes.size();
-        callWriteWasmLog(log_message.str().c_str());
+        // Run the post-processing stages of convert_to_midi, so the MIDI
+        // file can be encoded straight into the buffer handed to JavaScript
+        basic_pitch::NoteEventList note_events =
+            basic_pitch::output_to_notes_polyphonic(inference_result, config);
+        if (config.include_pitch_bends)
+        {
+            basic_pitch::add_pitch_bends(inference_result.contours,
+                                         note_events,
+                                         inference_result.pitch_range);
+        }
 
-        // Allocate memory in WASM for the MIDI data and copy the contents
-        *midi_size = midiBytes.size();
-        *midi_data_ptr = (uint8_t *)malloc(*midi_size);
+        // Allocate memory in WASM for the MIDI data and write it in place
+        *midi_data_ptr = (uint8_t *)malloc(
+            basic_pitch::midi_size_bound(note_events));
         if (*midi_data_ptr == nullptr)
         {
             callWriteWasmLog("Failed to allocate memory for MIDI data.");
@@ -54,5 +78,25 @@ extern "C"
             *midi_size = 0;
             return;
         }
+        *midi_size =
+            basic_pitch::write_midi(note_events, config, *midi_data_ptr);
+
+        callWriteWasmLog("MIDI file generated. Now saving to blob...");
+
+        // Log the size of the MIDI data
+        std::ostringstream log_message;
+        log_message << "MIDI data size: " << *midi_size;
+        callWriteWasmLog(log_message.str().c_str());
+    }
+
+    EMSCRIPTEN_KEEPALIVE
+    void convertToMidi(const float *mono_audio, int length,
+                       uint8_t **midi_data_ptr, int *midi_size)
+    {
+        using namespace basic_pitch::constants;
+        convertToMidiWithConfig(mono_audio, length, ONSET_THRESHOLD,
+                                FRAME_THRESHOLD, MIN_NOTE_LEN, ENERGY_TOL, 1, 1,
+                                MIDI_TEMPO_BPM, MIDI_PROGRAM, midi_data_ptr,
+                                midi_size);
     }
 }